@@ -73,11 +73,109 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 typedef struct {
     snd_mixer_t *mixer;                 /* The mixer */
-    guint num_channels;                 /* Number of channels */
-    GIOChannel **channels;              /* Channels that we listen to */
-    guint *watches;                     /* Watcher IDs for channels */
+    char *device;                       /* Name of the device to which the mixer is attached */
+    GSource *source;                    /* Source for events on the mixer's poll descriptors */
+    gboolean failed;                    /* Flag to indicate that the mixer has reported an error */
 } mixer_info_t;
 
+typedef struct {
+    snd_mixer_t *mixer;                 /* The mixer */
+    char *device;                       /* Name of the device to which the mixer is attached */
+} pooled_mixer_t;
+
+#define MIXER_POOL_SIZE 3
+
+/* Interval between volume writes when not synchronised to the frame clock (ms) */
+#define VOLUME_WRITE_INTERVAL 20
+
+/* Interval between steps of a volume fade, and default duration of the fade on mute and unmute (ms) */
+#define FADE_INTERVAL 10
+#define MUTE_FADE_TIME 100
+
+typedef struct {
+    GSource source;                     /* Parent */
+    snd_mixer_t *mixer;                 /* The mixer */
+    int nfds;                           /* Number of poll descriptors */
+    GPollFD *fds;                       /* Poll descriptors as polled by the main loop */
+    struct pollfd *pfds;                /* Poll descriptors as passed to ALSA */
+} mixer_source_t;
+
+typedef gboolean (*MixerSourceFunc) (snd_mixer_t *mixer, unsigned short revents, gpointer user_data);
+
+typedef enum {
+    SECTION_DEFAULT = 0,
+    SECTION_OUTPUT = 1,
+    SECTION_INPUT = 2,
+    SECTION_CTL = 3,
+    NUM_SECTIONS = 4
+} AsoundSection;
+
+typedef struct {
+    char *type;                         /* Value of type field */
+    char *card;                         /* Value of card field */
+    char *device;                       /* Value of device field */
+    char *slave;                        /* Value of slave.pcm field */
+} asound_section_t;
+
+typedef struct {
+    AsoundSection sect;                 /* Which section this is */
+    gsize start;                        /* Offset of start of section in file */
+    gsize end;                          /* Offset of end of section in file */
+} asound_range_t;
+
+typedef struct {
+    gboolean exists;                    /* .asoundrc was found */
+    gboolean asym;                      /* pcm.!default is of type asym */
+    int card;                           /* Default output card number, or BLUEALSA_DEV */
+    int input;                          /* Default input card number, or BLUEALSA_DEV */
+    char *bt_output;                    /* BlueZ path of Bluetooth output device, if any */
+    char *bt_input;                     /* BlueZ path of Bluetooth input device, if any */
+} asound_config_t;
+
+typedef struct {
+    guint count;                        /* Number of calls */
+    gint64 time;                        /* Cumulative wall time in microseconds */
+} stat_t;
+
+typedef struct {
+    gboolean db;                        /* Values are in hundredths of a dB rather than raw */
+    gboolean log;                       /* Percentages map logarithmically onto the dB range */
+    long values[3][101];                /* Value to set for each percentage - rounded down, to nearest, up */
+    long thresholds[101];               /* Lowest value which reads back as each percentage */
+    int last;                           /* Percentage last read or written, or -1 if none - gives the rounding direction of writes */
+} volume_curve_t;
+
+typedef struct {
+    guint caps;                         /* Available controls - combination of CardCaps */
+    guint channels;                     /* Playback channels present - bit n set for snd_mixer_selem_channel_id_t n */
+    volume_curve_t *curve;              /* Playback volume curve - also gives the dB or raw mode */
+} master_info_t;
+
+typedef struct {
+    int num;                            /* ALSA card number */
+    char *id;                           /* ALSA card id */
+    char *name;                         /* ALSA card name */
+    int bcm;                            /* Internal device type - see asound_is_bcm_device */
+    guint caps;                         /* Available controls - combination of CardCaps */
+} card_info_t;
+
+typedef struct {
+    int sections[2];                    /* Number of sorted sections in the output and input menus - 0 if there is no input menu */
+    gboolean settings;                  /* Flag to indicate that the output menu has a settings item */
+    gboolean devices;                   /* Flag to indicate that any output devices are listed */
+} menu_layout_t;
+
+typedef struct {
+    int menu;                           /* Menu holding the item - OUTPUT_MIXER or INPUT_MIXER */
+    int section;                        /* Sorted section of the menu holding the item */
+    char *key;                          /* Key of the item in the menu - the device name, except for internal routes */
+    char *name;                         /* Device name passed to the handler - card number, route or BlueZ object path */
+    char *label;                        /* Label shown in the menu */
+    gboolean selected;                  /* Flag to indicate that the device is in use */
+    gboolean novol;                     /* Flag to indicate that the device has no volume control */
+    GCallback cb;                       /* Handler to select the device */
+} menu_entry_t;
+
 typedef struct {
 
     /* plugin */
@@ -91,22 +189,71 @@ typedef struct {
     GtkWidget *volume_scale;            /* Scale for volume */
     GtkWidget *mute_check;              /* Checkbox for mute state */
     GtkWidget *menu_popup;              /* Right-click menu */
+    GtkWidget *menu_devices[2];         /* Output and input device menus - the output menu is menu_popup if there are no inputs */
+    GtkWidget *menu_settings[2];        /* Output and input device settings items, or NULL if not shown */
+    GHashTable *menu_items[2];          /* Output and input device menu items, keyed by menu_entry_t key */
+    menu_layout_t menu_layout;          /* Sections of the right-click menu as built */
+    gboolean menu_dirty;                /* Flag to indicate that the right-click menu needs to be updated */
+    guint menu_idle;                    /* Idle callback to update the right-click menu */
     GtkWidget *options_dlg;             /* Device options dialog */
     GtkWidget *options_play;            /* Playback options table */
     GtkWidget *options_capt;            /* Capture options table */
     GtkWidget *options_set;             /* General settings box */
+    GtkWidget *options_notebook;        /* Notebook holding the options tabs */
+    snd_mixer_t *options_mixer;         /* Mixer shown in the options dialog */
+    guint options_filled;               /* Tabs on which controls have been created - bitmask of 1 << OptionPage */
+    guint options_idle;                 /* Idle callback to create controls on the first tab */
+    GtkListStore *options_store[2];     /* Playback and capture volume lists, or NULL if shown as sliders */
+    GHashTable *options_rows[2];        /* Row in each volume list for each element */
+    GHashTable *options_ctrls;          /* Options dialog controls for each element, indexed by OptionControl */
     gboolean show_popup;                /* Toggle to show and hide the popup on left click */
+    gboolean popup_placed;              /* Flag to indicate that the popup position below is valid */
+    GdkRectangle popup_anchor;          /* Allocation of the plugin when the popup position was found */
+    gint popup_x, popup_y;              /* Position of the popup */
     guint volume_scale_handler;         /* Handler for vscale widget */
+    gboolean display_dirty;             /* Flag to indicate that the display needs to be redrawn */
+    guint display_tick;                 /* Frame clock callback for queued redraw */
+    guint display_idle;                 /* Idle callback for queued redraw when the plugin is not mapped */
+    const char *disp_icon;              /* Icon last displayed, or NULL if unknown */
+    int disp_level;                     /* Level last displayed in popup, or -1 if unknown */
+    int disp_mute;                      /* Mute state last displayed in popup, or -1 if unknown */
+    int disp_has_mute;                  /* Mute availability last displayed in popup, or -1 if unknown */
+    int disp_valid;                     /* Master element validity last displayed in popup, or -1 if unknown */
+    int disp_tooltip;                   /* Level last displayed in tooltip, -2 for no control, or -1 if unknown */
     guint mute_check_handler;           /* Handler for mute_check widget */
+    int volume_pending;                 /* Volume set on the scale but not yet written, or -1 if none */
+    guint volume_tick;                  /* Frame clock callback for pending volume write */
+    guint volume_timer;                 /* Timer for pending volume write when the scale is not mapped */
+    int volume_interval;                /* Interval between volume writes in ms, or 0 to write once per frame */
+    int volume_echo;                    /* Volume last written, expected back in the next mixer event, or -1 */
+    gboolean volume_echo_mute;          /* Mute state when the volume was last written */
+    guint fade_timer;                   /* Timer for steps of a volume fade */
+    gint64 fade_start;                  /* Time at which the current fade started */
+    int fade_time;                      /* Duration of the current fade in ms */
+    int fade_from;                      /* Volume at the start of the current fade */
+    int fade_to;                        /* Volume at the end of the current fade */
+    int fade_level;                     /* Volume last written by the current fade */
+    gboolean fade_mute;                 /* Flag to indicate that the current fade ends by muting */
+    int fade_restore;                   /* Volume to restore once muted at the end of the fade */
+    int mute_fade_time;                 /* Duration of the fade on mute and unmute in ms */
     char *odev_name;
     char *idev_name;
 
     /* ALSA interface. */
     mixer_info_t mixers[2];             /* mixers[0] = output; mixers[1] = input */
+    GList *mixer_pool;                  /* Recently used mixers which are kept open - most recent first */
     snd_mixer_elem_t *master_element;   /* Master element on output mixer - main volume control */
-    guint mixer_evt_idle;               /* Timer to handle mixer reset */
+    master_info_t master;               /* Capabilities of master element */
     guint restart_idle;                 /* Timer to handle restarting */
     gboolean stopped;                   /* Flag to indicate that ALSA is restarting */
+    GArray *cards;                      /* Table of installed sound cards */
+    GFileMonitor *cards_mon;            /* Monitor for sound cards being added or removed */
+    guint cards_idle;                   /* Timer to update card table after hotplug */
+    gboolean analog;                    /* Flag to indicate that the hardware has an analog jack */
+    snd_ctl_t *route_ctl;               /* Control interface on legacy internal device */
+    int route;                          /* Current output route on legacy internal device */
+    GIOChannel *route_channel;          /* Channel for events on legacy internal device */
+    guint route_watch;                  /* Watch for events on legacy internal device */
 
     /* Bluetooth interface */
     GDBusObjectManager *objmanager;     /* BlueZ object manager */
@@ -119,16 +266,63 @@ typedef struct {
     GDBusProxy *baproxy;                /* Proxy for BlueALSA */
     gulong basignal;                    /* ID of g-signal handler on BlueALSA */
 
+    /* .asoundrc */
+    asound_config_t asoundrc;           /* Cached default device settings */
+    gboolean asoundrc_valid;            /* Flag to indicate that cached settings match the file */
+    GFileMonitor *asoundrc_mon;         /* Monitor for changes to the file */
+
+    /* Cost accounting */
+    GHashTable *stats;                  /* Call counts and times for expensive operations, keyed by call site */
+
     /* HDMI devices */
     guint hdmis;                        /* Number of HDMI devices */
-    char *mon_names[2];                 /* Names of HDMI devices */
+    char **mon_names;                   /* Names of HDMI devices */
 } VolumeALSAPlugin;
 
+typedef struct {
+    VolumeALSAPlugin *vol;              /* Back pointer to plugin */
+    volume_curve_t *curves[2];          /* curves[0] = playback; curves[1] = capture */
+} elem_info_t;
+
 typedef enum {
     OUTPUT_MIXER = 0,
     INPUT_MIXER = 1
 } MixerIO;
 
+typedef enum {
+    CAP_PLAYBACK_VOLUME = 0x01,
+    CAP_PLAYBACK_SWITCH = 0x02,
+    CAP_CAPTURE_VOLUME = 0x04,
+    CAP_CAPTURE_SWITCH = 0x08
+} CardCaps;
+
+typedef enum {
+    OPT_PLAYBACK_VOLUME = 0,
+    OPT_PLAYBACK_SWITCH = 1,
+    OPT_CAPTURE_VOLUME = 2,
+    OPT_CAPTURE_SWITCH = 3,
+    OPT_ENUM = 4,
+    NUM_OPT_CONTROLS = 5
+} OptionControl;
+
+typedef enum {
+    OPT_PAGE_PLAYBACK = 0,
+    OPT_PAGE_CAPTURE = 1,
+    OPT_PAGE_SETTINGS = 2
+} OptionPage;
+
+typedef enum {
+    OPT_COL_ELEM = 0,
+    OPT_COL_NAME = 1,
+    OPT_COL_VOLUME = 2,
+    OPT_COL_SWITCH = 3,
+    OPT_COL_HAS_SWITCH = 4,
+    NUM_OPT_COLS = 5
+} OptionColumn;
+
+/* Number of volume controls on a tab above which they are shown as a list rather than as sliders */
+#define OPTIONS_LIST_THRESHOLD 32
+
 #define BLUEALSA_DEV (-99)
 
 #define BT_SERV_AUDIO_SOURCE    "0000110A"
@@ -137,11 +331,13 @@ typedef enum {
 #define BT_SERV_HFP             "0000111E"
 
 /* Helpers */
-static char *get_string (const char *fmt, ...);
-static int get_value (const char *fmt, ...);
-static int vsystem (const char *fmt, ...);
-static gboolean find_in_section (char *file, char *sec, char *seek);
-static int hdmi_monitors (VolumeALSAPlugin *vol);
+static gint64 stat_start (void);
+static void stat_end (VolumeALSAPlugin *vol, const char *site, gint64 start);
+static void stat_dump (VolumeALSAPlugin *vol);
+static void hdmi_monitors (VolumeALSAPlugin *vol);
+static void hdmi_monitors_changed (GdkDisplay *display, GdkMonitor *monitor, gpointer user_data);
+static gint hdmi_name_compare (gconstpointer a, gconstpointer b);
+static const char *hdmi_monitor_name (VolumeALSAPlugin *vol, int index);
 
 /* Bluetooth */
 static void bt_cb_name_owned (GDBusConnection *connection, const gchar *name, const gchar *owner, gpointer user_data);
@@ -149,6 +345,8 @@ static void bt_cb_name_unowned (GDBusConnection *connection, const gchar *name,
 static void bt_cb_ba_name_owned (GDBusConnection *connection, const gchar *name, const gchar *owner, gpointer user_data);
 static void bt_cb_ba_name_unowned (GDBusConnection *connection, const gchar *name, gpointer user_data);
 static void bt_cb_ba_signal (GDBusProxy *prox, gchar *sender, gchar *signal, GVariant *params, gpointer user_data);
+static void bt_cb_object_changed (GDBusObjectManager *manager, GDBusObject *object, gpointer user_data);
+static void bt_cb_properties_changed (GDBusObjectManagerClient *manager, GDBusObjectProxy *object, GDBusProxy *proxy, GVariant *changed, GStrv invalidated, gpointer user_data);
 static void bt_connect_device (VolumeALSAPlugin *vol);
 static void bt_cb_connected (GObject *source, GAsyncResult *res, gpointer user_data);
 static void bt_cb_trusted (GObject *source, GAsyncResult *res, gpointer user_data);
@@ -161,52 +359,116 @@ static gboolean bt_is_connected (VolumeALSAPlugin *vol, const gchar *path);
 
 /* Volume and mute */
 static long lrint_dir (double x, int dir);
+static int curve_percent (long value, long min, long max, gboolean log);
+static volume_curve_t *build_volume_curve (snd_mixer_elem_t *elem, gboolean capture);
+static int curve_lookup (volume_curve_t *curve, long value);
+static int curve_get_volume (snd_mixer_elem_t *elem, volume_curve_t *curve, gboolean capture);
+static int curve_set_volume (snd_mixer_elem_t *elem, volume_curve_t *curve, int volume, gboolean capture);
 static int get_normalized_volume (snd_mixer_elem_t *elem, gboolean capture);
-static int set_normalized_volume (snd_mixer_elem_t *elem, int volume, int dir, gboolean capture);
+static int set_normalized_volume (snd_mixer_elem_t *elem, int volume, gboolean capture);
 static gboolean asound_has_mute (VolumeALSAPlugin *vol);
 static gboolean asound_is_muted (VolumeALSAPlugin *vol);
 static void asound_set_mute (VolumeALSAPlugin *vol, gboolean mute);
 static int asound_get_volume (VolumeALSAPlugin *vol);
 static void asound_set_volume (VolumeALSAPlugin *vol, int volume);
+static void asound_fade_volume (VolumeALSAPlugin *vol, int volume, int ms);
+static void asound_fade_mute (VolumeALSAPlugin *vol, gboolean mute);
+static void asound_fade_start (VolumeALSAPlugin *vol, int from, int to, int ms);
+static void asound_fade_cancel (VolumeALSAPlugin *vol);
+static gboolean asound_fade_step (gpointer user_data);
 
 /* ALSA */
 static gboolean asound_initialize (VolumeALSAPlugin *vol);
 static void asound_deinitialize (VolumeALSAPlugin *vol);
 static gboolean asound_find_master_elem (VolumeALSAPlugin *vol);
+static void asound_set_master_elem (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem);
 static gboolean asound_mixer_initialize (VolumeALSAPlugin *vol, MixerIO io);
+static int asound_mixer_elem_added (snd_mixer_t *mixer, unsigned int mask, snd_mixer_elem_t *elem);
+static int asound_elem_event (snd_mixer_elem_t *elem, unsigned int mask);
+static void asound_elem_build_curves (elem_info_t *info, snd_mixer_elem_t *elem);
+static void asound_elem_free (snd_mixer_elem_t *elem);
+static void asound_mixer_free_elems (snd_mixer_t *mixer);
 static void asound_mixer_deinitialize (VolumeALSAPlugin *vol, MixerIO io);
+static void asound_mixer_close (snd_mixer_t *mixer, const char *device);
+static snd_mixer_t *asound_pool_get (VolumeALSAPlugin *vol, const char *device);
+static void asound_pool_put (VolumeALSAPlugin *vol, snd_mixer_t *mixer, const char *device);
+static void asound_pool_flush (VolumeALSAPlugin *vol);
 static gboolean asound_current_dev_check (VolumeALSAPlugin *vol);
-static gboolean asound_has_volume_control (int dev);
-static gboolean asound_has_input (int dev);
+static guint asound_get_caps (int dev);
+static guint asound_default_caps (VolumeALSAPlugin *vol);
+static void asound_build_card_table (VolumeALSAPlugin *vol);
+static void asound_free_card_table (VolumeALSAPlugin *vol);
+static gboolean asound_has_analog (void);
+static gboolean asound_update_card_table (gpointer user_data);
+static void asound_cards_changed (GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent evt, gpointer user_data);
+static void asound_route_open (VolumeALSAPlugin *vol);
+static void asound_route_close (VolumeALSAPlugin *vol);
+static int asound_route_read (VolumeALSAPlugin *vol);
+static void asound_route_write (VolumeALSAPlugin *vol, int route);
+static gboolean asound_route_event (GIOChannel *channel, GIOCondition cond, gpointer user_data);
 static gboolean asound_restart (gpointer user_data);
-static gboolean asound_reset_mixer_evt_idle (gpointer user_data);
-static gboolean asound_mixer_event (GIOChannel *channel, GIOCondition cond, gpointer user_data);
+static GSource *asound_mixer_source_new (snd_mixer_t *mixer);
+static gboolean asound_mixer_source_prepare (GSource *source, gint *timeout);
+static gboolean asound_mixer_source_check (GSource *source);
+static gboolean asound_mixer_source_dispatch (GSource *source, GSourceFunc callback, gpointer user_data);
+static void asound_mixer_source_finalize (GSource *source);
+static gboolean asound_mixer_event (snd_mixer_t *mixer, unsigned short revents, gpointer user_data);
 
 /* .asoundrc */
-static int asound_get_default_card (void);
-static int asound_get_default_input (void);
-static void asound_set_default_card (int num);
-static void asound_set_default_input (int num);
-static char *asound_get_bt_device (void);
-static char *asound_get_bt_input (void);
-static void asound_set_bt_device (const char *devname);
-static void asound_set_bt_input (const char *devname);
-static gboolean asound_is_current_bt_dev (const char *obj, gboolean is_input);
-static int asound_get_bcm_device_num (void);
-static int asound_is_bcm_device (int num);
-static char *asound_default_device_name (void);
-static char *asound_default_input_name (void);
+static void asound_conf_skip_space (const char **pos);
+static char asound_conf_token (const char **pos, char **tok);
+static void asound_conf_skip (const char **pos);
+static void asound_conf_read_section (const char **pos, asound_section_t *sect);
+static void asound_parse_config (const char *text, asound_section_t *sects, GArray *ranges);
+static void asound_free_section (asound_section_t *sect);
+static int asound_card_index (const char *card);
+static int asound_section_card (asound_section_t *sect);
+static char *asound_section_bt_device (asound_section_t *sect);
+static void asound_read_config (asound_config_t *conf);
+static void asound_free_config (asound_config_t *conf);
+static asound_config_t *asound_get_config (VolumeALSAPlugin *vol);
+static void asound_invalidate_config (VolumeALSAPlugin *vol);
+static char *asound_bt_address (const char *devname);
+static void asound_write_config (VolumeALSAPlugin *vol, const char *output, const char *input, const char *ctl);
+static void asound_config_changed (GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent evt, gpointer user_data);
+static int asound_get_default_card (VolumeALSAPlugin *vol);
+static int asound_get_default_input (VolumeALSAPlugin *vol);
+static void asound_set_default_card (VolumeALSAPlugin *vol, int num);
+static void asound_set_default_input (VolumeALSAPlugin *vol, int num);
+static char *asound_get_bt_device (VolumeALSAPlugin *vol);
+static char *asound_get_bt_input (VolumeALSAPlugin *vol);
+static void asound_set_bt_device (VolumeALSAPlugin *vol, const char *devname);
+static void asound_set_bt_input (VolumeALSAPlugin *vol, const char *devname);
+static gboolean asound_is_current_bt_dev (VolumeALSAPlugin *vol, const char *obj, gboolean is_input);
+static int asound_get_bcm_device_num (VolumeALSAPlugin *vol);
+static int asound_is_bcm_device (const char *name);
+static char *asound_default_device_name (VolumeALSAPlugin *vol);
+static char *asound_default_input_name (VolumeALSAPlugin *vol);
 
 /* Handlers and graphics */
 static void volumealsa_update_display (VolumeALSAPlugin *vol);
+static void volumealsa_queue_update_display (VolumeALSAPlugin *vol);
+static void volumealsa_reset_display (VolumeALSAPlugin *vol);
+static gboolean volumealsa_update_display_tick (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data);
+static gboolean volumealsa_update_display_idle (gpointer user_data);
 static void volumealsa_open_config_dialog (GtkWidget *widget, VolumeALSAPlugin *vol);
 static void volumealsa_show_connect_dialog (VolumeALSAPlugin *vol, gboolean failed, const gchar *param);
 static void volumealsa_close_connect_dialog (GtkButton *button, gpointer user_data);
 static gboolean volumealsa_button_press_event (GtkWidget *widget, GdkEventButton *event, LXPanel *panel);
 
 /* Menu popup */
-static GtkWidget *volumealsa_menu_item_add (VolumeALSAPlugin *vol, GtkWidget *menu, const char *label, const char *name, gboolean selected, gboolean input, GCallback cb);
-static void volumealsa_build_device_menu (VolumeALSAPlugin *vol);
+static void volumealsa_menu_entry_add (GPtrArray *entries, MixerIO menu, int section, const char *name, const char *label, gboolean selected, gboolean novol, GCallback cb);
+static void volumealsa_menu_entry_free (gpointer data);
+static GPtrArray *volumealsa_device_menu_entries (VolumeALSAPlugin *vol, menu_layout_t *layout);
+static void volumealsa_menu_sections_add (GtkWidget *menu, int sections);
+static void volumealsa_menu_section_insert (GtkWidget *menu, GtkWidget *mi, int section);
+static void volumealsa_menu_section_remove (GtkWidget *menu, GtkWidget *mi);
+static void volumealsa_menu_item_set_label (GtkWidget *mi, const char *label, gboolean novol);
+static void volumealsa_build_device_menu (VolumeALSAPlugin *vol, const menu_layout_t *layout);
+static void volumealsa_reset_device_menu (VolumeALSAPlugin *vol);
+static void volumealsa_update_device_menu (VolumeALSAPlugin *vol);
+static void volumealsa_queue_device_menu (VolumeALSAPlugin *vol);
+static gboolean volumealsa_device_menu_idle (gpointer user_data);
 static void volumealsa_set_external_output (GtkWidget *widget, VolumeALSAPlugin *vol);
 static void volumealsa_set_external_input (GtkWidget *widget, VolumeALSAPlugin *vol);
 static void volumealsa_set_internal_output (GtkWidget *widget, VolumeALSAPlugin *vol);
@@ -217,6 +479,10 @@ static void volumealsa_set_bluetooth_input (GtkWidget *widget, VolumeALSAPlugin
 static void volumealsa_build_popup_window (GtkWidget *p);
 static void volumealsa_popup_scale_changed (GtkRange *range, VolumeALSAPlugin *vol);
 static void volumealsa_popup_scale_scrolled (GtkScale *scale, GdkEventScroll *evt, VolumeALSAPlugin *vol);
+static void volumealsa_queue_volume_write (VolumeALSAPlugin *vol);
+static void volumealsa_write_volume (VolumeALSAPlugin *vol);
+static gboolean volumealsa_write_volume_tick (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data);
+static gboolean volumealsa_write_volume_timer (gpointer user_data);
 static void volumealsa_popup_mute_toggled (GtkWidget *widget, VolumeALSAPlugin *vol);
 static gboolean volumealsa_popup_mapped (GtkWidget *widget, GdkEvent *event, VolumeALSAPlugin *vol);
 static gboolean volumealsa_popup_button_press (GtkWidget *widget, GdkEventButton *event, VolumeALSAPlugin *vol);
@@ -225,7 +491,15 @@ static gboolean volumealsa_popup_button_press (GtkWidget *widget, GdkEventButton
 static void show_options (VolumeALSAPlugin *vol, snd_mixer_t *mixer, gboolean input, char *devname);
 static void show_input_options (VolumeALSAPlugin *vol);
 static void show_output_options (VolumeALSAPlugin *vol);
-static void update_options (VolumeALSAPlugin *vol);
+static void options_fill_page (VolumeALSAPlugin *vol, OptionPage page);
+static gboolean options_fill_idle (gpointer user_data);
+static void options_page_switched (GtkNotebook *notebook, GtkWidget *page, guint page_num, gpointer user_data);
+static GtkWidget *options_list_new (VolumeALSAPlugin *vol, gboolean capture);
+static void options_list_add (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem, gboolean capture);
+static void options_list_update (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem, gboolean capture);
+static void options_list_volume_edited (GtkCellRendererText *cell, gchar *path, gchar *text, gpointer user_data);
+static void options_list_switch_toggled (GtkCellRendererToggle *cell, gchar *path, gpointer user_data);
+static void update_options (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem);
 static void close_options (VolumeALSAPlugin *vol);
 static void options_ok_handler (GtkButton *button, gpointer *user_data);
 static gboolean options_wd_close_handler (GtkWidget *wid, GdkEvent *event, gpointer user_data);
@@ -234,7 +508,8 @@ static void capture_range_change_event (GtkRange *range, gpointer user_data);
 static void playback_switch_toggled_event (GtkToggleButton *togglebutton, gpointer user_data);
 static void capture_switch_toggled_event (GtkToggleButton *togglebutton, gpointer user_data);
 static void enum_changed_event (GtkComboBox *combo, gpointer *user_data);
-static GtkWidget *find_box_child (GtkWidget *container, gint type, const char *name);
+static void options_add_control (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem, OptionControl type, GtkWidget *wid);
+static GtkWidget *options_find_control (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem, OptionControl type);
 
 /* Plugin */
 static GtkWidget *volumealsa_configure (LXPanel *panel, GtkWidget *plugin);
@@ -247,96 +522,105 @@ static void volumealsa_destructor (gpointer user_data);
 /* Generic helper functions                                                   */
 /*----------------------------------------------------------------------------*/
 
-static char *get_string (const char *fmt, ...)
+/* Cost accounting - call counts and cumulative wall time for the operations which
+ * access the filesystem, the sound hardware or spawn processes, keyed by call site */
+
+static gint64 stat_start (void)
 {
-    char *cmdline, *line = NULL, *res = NULL;
-    size_t len = 0;
+    return g_get_monotonic_time ();
+}
+
+static void stat_end (VolumeALSAPlugin *vol, const char *site, gint64 start)
+{
+    stat_t *stat;
 
-    va_list arg;
-    va_start (arg, fmt);
-    g_vasprintf (&cmdline, fmt, arg);
-    va_end (arg);
+    if (!vol->stats) vol->stats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
 
-    FILE *fp = popen (cmdline, "r");
-    if (fp)
+    stat = g_hash_table_lookup (vol->stats, site);
+    if (!stat)
     {
-        if (getline (&line, &len, fp) > 0)
-        {
-            res = line;
-            while (*res++) if (g_ascii_isspace (*res)) *res = 0;
-            res = g_strdup (line);
-        }
-        pclose (fp);
-        g_free (line);
+        stat = g_new0 (stat_t, 1);
+        g_hash_table_insert (vol->stats, (gpointer) site, stat);
     }
-    g_free (cmdline);
-    return res ? res : g_strdup ("");
+    stat->count++;
+    stat->time += g_get_monotonic_time () - start;
 }
 
-static int get_value (const char *fmt, ...)
+static void stat_dump (VolumeALSAPlugin *vol)
 {
-    char *res;
-    int n, m;
+    GHashTableIter iter;
+    gpointer key, value;
+    stat_t *stat;
 
-    res = get_string (fmt);
-    n = sscanf (res, "%d", &m);
-    g_free (res);
+    if (!vol->stats) return;
 
-    if (n != 1) return -1;
-    else return m;
+    g_hash_table_iter_init (&iter, vol->stats);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+        stat = (stat_t *) value;
+        g_message ("volumealsa: %s : %u calls, %.3f ms total, %.3f ms average", (const char *) key,
+            stat->count, stat->time / 1000.0, stat->time / (stat->count * 1000.0));
+    }
 }
 
-static int vsystem (const char *fmt, ...)
-{
-    char *cmdline;
-    int res;
-
-    va_list arg;
-    va_start (arg, fmt);
-    g_vasprintf (&cmdline, fmt, arg);
-    va_end (arg);
-    res = system (cmdline);
-    g_free (cmdline);
-    return res;
-}
+/* Multiple HDMI support */
 
-static gboolean find_in_section (char *file, char *sec, char *seek)
+static gint hdmi_name_compare (gconstpointer a, gconstpointer b)
 {
-    char *cmd = g_strdup_printf ("sed -n '/%s/,/}/p' %s 2>/dev/null | grep -q %s", sec, file, seek);
-    int res = system (cmd);
-    g_free (cmd);
-    if (res == 0) return TRUE;
-    else return FALSE;
+    return g_strcmp0 (*((char **) a), *((char **) b));
 }
 
-/* Multiple HDMI support */
-
-static int hdmi_monitors (VolumeALSAPlugin *vol)
+static void hdmi_monitors (VolumeALSAPlugin *vol)
 {
+    GdkDisplay *disp = gdk_display_get_default ();
+    gint64 start = stat_start ();
+    GPtrArray *names;
+    const char *model;
     int i, m;
 
-    /* check xrandr for connected monitors */
-    m = get_value ("xrandr -q | grep -c connected");
-    if (m < 0) m = 1; /* couldn't read, so assume 1... */
-    if (m > 2) m = 2;
+    g_strfreev (vol->mon_names);
+    vol->mon_names = NULL;
 
-    /* get the names */
-    if (m == 2)
+    /* the monitor model is the name of the connector - HDMI-1 etc. */
+    m = disp ? gdk_display_get_n_monitors (disp) : 0;
+    names = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; i < m; i++)
     {
-        for (i = 0; i < m; i++)
-        {
-            vol->mon_names[i] = get_string ("xrandr --listmonitors | grep %d: | cut -d ' ' -f 6", i);
-        }
+        model = gdk_monitor_get_model (gdk_display_get_monitor (disp, i));
+        if (model && !strncmp (model, "HDMI", 4)) g_ptr_array_add (names, g_strdup (model));
+    }
 
-        /* check both devices are HDMI */
-        if ((vol->mon_names[0] && strncmp (vol->mon_names[0], "HDMI", 4) != 0)
-            || (vol->mon_names[1] && strncmp (vol->mon_names[1], "HDMI", 4) != 0))
-                m = 1;
+    /* only use the names if all connected devices are HDMI */
+    if (m >= 2 && names->len == m)
+    {
+        g_ptr_array_sort (names, hdmi_name_compare);
+        g_ptr_array_add (names, NULL);
+        vol->mon_names = (char **) g_ptr_array_free (names, FALSE);
+        vol->hdmis = m;
+    }
+    else
+    {
+        g_ptr_array_free (names, TRUE);
+        vol->hdmis = (m || !disp) ? 1 : 0; /* no display to read, so assume 1... */
     }
+    DEBUG ("%d HDMI devices", vol->hdmis);
+    stat_end (vol, G_STRFUNC, start);
+}
+
+static void hdmi_monitors_changed (GdkDisplay *display, GdkMonitor *monitor, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
 
-    return m;
+    hdmi_monitors (vol);
+    volumealsa_queue_device_menu (vol);
 }
 
+/* Get the label for the HDMI device with the given (1-based) index */
+static const char *hdmi_monitor_name (VolumeALSAPlugin *vol, int index)
+{
+    if (vol->hdmis > 1 && index >= 1 && index <= vol->hdmis) return vol->mon_names[index - 1];
+    return _("HDMI");
+}
 
 /*----------------------------------------------------------------------------*/
 /* Bluetooth D-Bus interface                                                  */
@@ -359,13 +643,16 @@ static void bt_cb_name_owned (GDBusConnection *connection, const gchar *name, co
     else
     {
         /* register callbacks for devices being added or removed */
-        // now taken care of by monitoring PCMAdded / PCMRemoved signals on org.bluealsa
-        // g_signal_connect (vol->objmanager, "object-added", G_CALLBACK (bt_cb_object_added), vol);
-        // g_signal_connect (vol->objmanager, "object-removed", G_CALLBACK (bt_cb_object_removed), vol);
+        // connection is now taken care of by monitoring PCMAdded / PCMRemoved signals on org.bluealsa,
+        // so these are only used to keep the device menu up to date
+        g_signal_connect (vol->objmanager, "object-added", G_CALLBACK (bt_cb_object_changed), vol);
+        g_signal_connect (vol->objmanager, "object-removed", G_CALLBACK (bt_cb_object_changed), vol);
+        g_signal_connect (vol->objmanager, "interface-proxy-properties-changed", G_CALLBACK (bt_cb_properties_changed), vol);
+        volumealsa_queue_device_menu (vol);
 
         /* Check whether a Bluetooth audio device is the current default output or input - connect to one or both if so */
-        char *device = asound_get_bt_device ();
-        char *idevice = asound_get_bt_input ();
+        char *device = asound_get_bt_device (vol);
+        char *idevice = asound_get_bt_input (vol);
         if (device || idevice)
         {
             /* Reconnect the current Bluetooth audio device */
@@ -394,6 +681,7 @@ static void bt_cb_name_unowned (GDBusConnection *connection, const gchar *name,
     vol->objmanager = NULL;
     vol->bt_conname = NULL;
     vol->bt_reconname = NULL;
+    volumealsa_queue_device_menu (vol);
 }
 
 static void bt_cb_ba_name_owned (GDBusConnection *connection, const gchar *name, const gchar *owner, gpointer user_data)
@@ -429,7 +717,7 @@ static void bt_cb_ba_signal (GDBusProxy *prox, gchar *sender, gchar *signal, GVa
     if (!g_strcmp0 (signal, "PCMAdded") || !g_strcmp0 (signal, "PCMRemoved"))
     {
         DEBUG ("PCMs changed - %s", signal);
-        if (asound_get_default_card () == BLUEALSA_DEV)
+        if (asound_get_default_card (vol) == BLUEALSA_DEV)
         {
             asound_initialize (vol);
             volumealsa_update_display (vol);
@@ -437,6 +725,35 @@ static void bt_cb_ba_signal (GDBusProxy *prox, gchar *sender, gchar *signal, GVa
     }
 }
 
+static void bt_cb_object_changed (GDBusObjectManager *manager, GDBusObject *object, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    DEBUG ("BlueZ object %s added or removed", g_dbus_object_get_object_path (object));
+    volumealsa_queue_device_menu (vol);
+}
+
+static void bt_cb_properties_changed (GDBusObjectManagerClient *manager, GDBusObjectProxy *object, GDBusProxy *proxy, GVariant *changed, GStrv invalidated, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    GVariantIter iter;
+    const gchar *key;
+
+    if (g_strcmp0 (g_dbus_proxy_get_interface_name (proxy), "org.bluez.Device1")) return;
+
+    /* only the properties which are shown in or decide membership of the menu matter */
+    g_variant_iter_init (&iter, changed);
+    while (g_variant_iter_next (&iter, "{&sv}", &key, NULL))
+    {
+        if (!g_strcmp0 (key, "Alias") || !g_strcmp0 (key, "Icon") || !g_strcmp0 (key, "Paired")
+            || !g_strcmp0 (key, "Trusted") || !g_strcmp0 (key, "UUIDs"))
+        {
+            DEBUG ("BlueZ device %s changed %s", g_dbus_proxy_get_object_path (proxy), key);
+            volumealsa_queue_device_menu (vol);
+            return;
+        }
+    }
+}
+
 static void bt_connect_device (VolumeALSAPlugin *vol)
 {
     GDBusInterface *interface = g_dbus_object_manager_get_interface (vol->objmanager, vol->bt_conname, "org.bluez.Device1");
@@ -480,8 +797,8 @@ static void bt_cb_connected (GObject *source, GAsyncResult *res, gpointer user_d
         DEBUG ("Connected OK");
 
         // update asoundrc with connection details
-        if (vol->bt_input) asound_set_bt_input (vol->bt_conname);
-        else asound_set_bt_device (vol->bt_conname);
+        if (vol->bt_input) asound_set_bt_input (vol, vol->bt_conname);
+        else asound_set_bt_device (vol, vol->bt_conname);
 
         // close the connection dialog
         volumealsa_close_connect_dialog (NULL, vol);
@@ -622,9 +939,10 @@ static void bt_cb_disconnected (GObject *source, GAsyncResult *res, gpointer use
     {
         if (vol->bt_input == FALSE)
         {
-            // mixer and element handles will now be invalid
-            vol->mixers[OUTPUT_MIXER].mixer = NULL;
-            vol->master_element = NULL;
+            // mixer and element handles will now be invalid - release them, along with the
+            // event source and device name (Bluetooth mixers are never pooled, so it is closed)
+            asound_set_master_elem (vol, NULL);
+            asound_mixer_deinitialize (vol, OUTPUT_MIXER);
         }
 
         DEBUG ("Connecting to %s...", vol->bt_conname);
@@ -675,106 +993,171 @@ static long lrint_dir (double x, int dir)
     else return lrint (x);
 }
 
-static int get_normalized_volume (snd_mixer_elem_t *elem, gboolean capture)
+/* The mapping between percentages and mixer values is worked out once for each element when
+ * it is added to the mixer, so reading and setting the volume are just table lookups. */
+
+/* Convert a mixer value to a percentage */
+static int curve_percent (long value, long min, long max, gboolean log)
 {
-    long min, max, lvalue, rvalue;
     double normalized, min_norm;
-    int err;
-
-    err = capture ? snd_mixer_selem_get_capture_dB_range (elem, &min, &max) : snd_mixer_selem_get_playback_dB_range (elem, &min, &max);
-    if (err < 0 || min >= max)
-    {
-        err = capture ? snd_mixer_selem_get_capture_volume_range (elem, &min, &max) : snd_mixer_selem_get_playback_volume_range (elem, &min, &max);
-        if (err < 0 || min == max) return 0;
-
-        err = capture ? snd_mixer_selem_get_capture_volume (elem, SND_MIXER_SCHN_FRONT_LEFT, &lvalue) : snd_mixer_selem_get_playback_volume (elem, SND_MIXER_SCHN_FRONT_LEFT, &lvalue);
-        if (err < 0) return 0;
-
-        err = capture ? snd_mixer_selem_get_capture_volume (elem, SND_MIXER_SCHN_FRONT_RIGHT, &rvalue) : snd_mixer_selem_get_playback_volume (elem, SND_MIXER_SCHN_FRONT_RIGHT, &rvalue);
-        if (err < 0) return 0;
-
-        lvalue += rvalue;
-        lvalue >>= 1;
-        lvalue -= min;
-        lvalue *= 100;
-        lvalue /= (max - min);
-        return (int) lvalue;
-    }
-
-    err = capture ? snd_mixer_selem_get_capture_dB (elem, SND_MIXER_SCHN_FRONT_LEFT, &lvalue) : snd_mixer_selem_get_playback_dB (elem, SND_MIXER_SCHN_FRONT_LEFT, &lvalue);
-    if (err < 0) return 0;
 
-    err = capture ? snd_mixer_selem_get_capture_dB (elem, SND_MIXER_SCHN_FRONT_RIGHT, &rvalue) : snd_mixer_selem_get_playback_dB (elem, SND_MIXER_SCHN_FRONT_RIGHT, &rvalue);
-    if (err < 0) return 0;
+    if (!log) return (value - min) * 100 / (max - min);
 
-    lvalue += rvalue;
-    lvalue >>= 1;
-
-    if (max - min <= 2400)
-    {
-        lvalue -= min;
-        lvalue *= 100;
-        lvalue /= (max - min);
-        return (int) lvalue;
-    }
-
-    normalized = exp10 ((lvalue - max) / 6000.0);
+    normalized = exp10 ((value - max) / 6000.0);
     if (min != SND_CTL_TLV_DB_GAIN_MUTE)
     {
         min_norm = exp10 ((min - max) / 6000.0);
         normalized = (normalized - min_norm) / (1 - min_norm);
     }
-
     return (int) round (normalized * 100);
 }
 
-static int set_normalized_volume (snd_mixer_elem_t *elem, int volume, int dir, gboolean capture)
+static volume_curve_t *build_volume_curve (snd_mixer_elem_t *elem, gboolean capture)
 {
-    long min, max, value;
-    double min_norm;
-    int err;
-    double vol_perc = (double) volume / 100;
+    volume_curve_t *curve;
+    long min, max, lo, hi, mid;
+    double vol_perc, min_norm = 0.0;
+    int err, p, dir;
 
+    if (capture ? !snd_mixer_selem_has_capture_volume (elem) : !snd_mixer_selem_has_playback_volume (elem)) return NULL;
+
+    curve = g_new0 (volume_curve_t, 1);
+    curve->db = TRUE;
+    curve->last = -1;
     err = capture ? snd_mixer_selem_get_capture_dB_range (elem, &min, &max) : snd_mixer_selem_get_playback_dB_range (elem, &min, &max);
     if (err < 0 || min >= max)
     {
+        curve->db = FALSE;
         err = capture ? snd_mixer_selem_get_capture_volume_range (elem, &min, &max) : snd_mixer_selem_get_playback_volume_range (elem, &min, &max);
-        if (err < 0) return err;
+        if (err < 0 || min == max)
+        {
+            g_free (curve);
+            return NULL;
+        }
+    }
+    curve->log = curve->db && max - min > 2400;
+    if (curve->log && min != SND_CTL_TLV_DB_GAIN_MUTE) min_norm = exp10 ((min - max) / 6000.0);
+
+    for (p = 0; p <= 100; p++)
+    {
+        /* values to set - indexed by rounding direction */
+        for (dir = -1; dir <= 1; dir++)
+        {
+            vol_perc = (double) p / 100;
+            if (!curve->log) curve->values[dir + 1][p] = lrint_dir (vol_perc * (max - min), dir) + min;
+            else if (p == 0 && min == SND_CTL_TLV_DB_GAIN_MUTE) curve->values[dir + 1][p] = min;
+            else
+            {
+                vol_perc = vol_perc * (1 - min_norm) + min_norm;
+                curve->values[dir + 1][p] = lrint_dir (6000.0 * log10 (vol_perc), dir) + max;
+            }
+        }
 
-        value = lrint_dir (vol_perc * (max - min), dir) + min;
-        return capture ? snd_mixer_selem_set_capture_volume_all (elem, value) : snd_mixer_selem_set_playback_volume_all (elem, value);
+        /* lowest value which reads back as this percentage or more - max + 1 if none does */
+        lo = p ? curve->thresholds[p - 1] : min;
+        hi = max + 1;
+        while (lo < hi)
+        {
+            mid = lo + (hi - lo) / 2;
+            if (curve_percent (mid, min, max, curve->log) >= p) hi = mid;
+            else lo = mid + 1;
+        }
+        curve->thresholds[p] = lo;
     }
 
-    if (max - min <= 2400)
+    return curve;
+}
+
+/* Find the percentage for a mixer value */
+static int curve_lookup (volume_curve_t *curve, long value)
+{
+    int lo = 0, hi = 100, mid;
+
+    if (value < curve->thresholds[0]) return 0;
+    while (lo < hi)
     {
-        value = lrint_dir (vol_perc * (max - min), dir) + min;
-        if (dir == 0) dir = 1;  // dir = 0 seems to round down...
-        return capture ? snd_mixer_selem_set_capture_dB_all (elem, value, dir) : snd_mixer_selem_set_playback_dB_all (elem, value, dir);
+        mid = (lo + hi + 1) / 2;
+        if (curve->thresholds[mid] <= value) lo = mid;
+        else hi = mid - 1;
     }
+    return lo;
+}
 
-    if (min != SND_CTL_TLV_DB_GAIN_MUTE)
+static int curve_get_volume (snd_mixer_elem_t *elem, volume_curve_t *curve, gboolean capture)
+{
+    long lvalue, rvalue;
+    int err;
+
+    if (!curve) return 0;
+
+    if (curve->db)
     {
-        min_norm = exp10 ((min - max) / 6000.0);
-        vol_perc = vol_perc * (1 - min_norm) + min_norm;
+        err = capture ? snd_mixer_selem_get_capture_dB (elem, SND_MIXER_SCHN_FRONT_LEFT, &lvalue) : snd_mixer_selem_get_playback_dB (elem, SND_MIXER_SCHN_FRONT_LEFT, &lvalue);
+        if (err < 0) return 0;
+
+        err = capture ? snd_mixer_selem_get_capture_dB (elem, SND_MIXER_SCHN_FRONT_RIGHT, &rvalue) : snd_mixer_selem_get_playback_dB (elem, SND_MIXER_SCHN_FRONT_RIGHT, &rvalue);
+        if (err < 0) return 0;
+    }
+    else
+    {
+        err = capture ? snd_mixer_selem_get_capture_volume (elem, SND_MIXER_SCHN_FRONT_LEFT, &lvalue) : snd_mixer_selem_get_playback_volume (elem, SND_MIXER_SCHN_FRONT_LEFT, &lvalue);
+        if (err < 0) return 0;
+
+        err = capture ? snd_mixer_selem_get_capture_volume (elem, SND_MIXER_SCHN_FRONT_RIGHT, &rvalue) : snd_mixer_selem_get_playback_volume (elem, SND_MIXER_SCHN_FRONT_RIGHT, &rvalue);
+        if (err < 0) return 0;
     }
-    value = lrint_dir (6000.0 * log10 (vol_perc), dir) + max;
+
+    lvalue += rvalue;
+    lvalue >>= 1;
+    curve->last = curve_lookup (curve, lvalue);
+    return curve->last;
+}
+
+/* Writes round towards the new percentage from the one last read or written, so that a small
+ * step always moves the volume - this avoids reading the element back before every write. */
+static int curve_set_volume (snd_mixer_elem_t *elem, volume_curve_t *curve, int volume, gboolean capture)
+{
+    long value;
+    int dir;
+
+    if (!curve) return -1;
+
+    if (volume < 0) volume = 0;
+    if (volume > 100) volume = 100;
+    dir = curve->last < 0 ? 0 : volume - curve->last;
+    curve->last = volume;
+    value = curve->values[dir < 0 ? 0 : (dir > 0 ? 2 : 1)][volume];
+
+    if (!curve->db) return capture ? snd_mixer_selem_set_capture_volume_all (elem, value) : snd_mixer_selem_set_playback_volume_all (elem, value);
+
+    if (!curve->log && dir == 0) dir = 1;  // dir = 0 seems to round down...
     return capture ? snd_mixer_selem_set_capture_dB_all (elem, value, dir) : snd_mixer_selem_set_playback_dB_all (elem, value, dir);
 }
 
+static int get_normalized_volume (snd_mixer_elem_t *elem, gboolean capture)
+{
+    elem_info_t *info = (elem_info_t *) snd_mixer_elem_get_callback_private (elem);
+
+    return curve_get_volume (elem, info ? info->curves[capture ? 1 : 0] : NULL, capture);
+}
+
+static int set_normalized_volume (snd_mixer_elem_t *elem, int volume, gboolean capture)
+{
+    elem_info_t *info = (elem_info_t *) snd_mixer_elem_get_callback_private (elem);
+
+    return curve_set_volume (elem, info ? info->curves[capture ? 1 : 0] : NULL, volume, capture);
+}
+
 /* Get the presence of the mute control from the sound system. */
 static gboolean asound_has_mute (VolumeALSAPlugin *vol)
 {
-    if (vol->master_element == NULL || snd_mixer_elem_get_type (vol->master_element) != SND_MIXER_ELEM_SIMPLE) return FALSE;
-
-    return snd_mixer_selem_has_playback_switch (vol->master_element);
+    return (vol->master.caps & CAP_PLAYBACK_SWITCH) ? TRUE : FALSE;
 }
 
 /* Get the condition of the mute control from the sound system. */
 static gboolean asound_is_muted (VolumeALSAPlugin *vol)
 {
-    if (vol->master_element == NULL || snd_mixer_elem_get_type (vol->master_element) != SND_MIXER_ELEM_SIMPLE) return FALSE;
-    if (!snd_mixer_selem_has_playback_channel (vol->master_element, SND_MIXER_SCHN_FRONT_LEFT)) return FALSE;
-    if (!snd_mixer_selem_has_playback_switch (vol->master_element)) return FALSE;
+    if (!(vol->master.caps & CAP_PLAYBACK_SWITCH) || !(vol->master.channels & (1u << SND_MIXER_SCHN_FRONT_LEFT))) return FALSE;
 
     /* The switch is on if sound is not muted, and off if the sound is muted.
      * Initialize so that the sound appears unmuted if the control does not exist. */
@@ -785,8 +1168,7 @@ static gboolean asound_is_muted (VolumeALSAPlugin *vol)
 
 static void asound_set_mute (VolumeALSAPlugin *vol, gboolean mute)
 {
-    if (vol->master_element == NULL || snd_mixer_elem_get_type (vol->master_element) != SND_MIXER_ELEM_SIMPLE) return;
-    if (!snd_mixer_selem_has_playback_switch (vol->master_element)) return;
+    if (!(vol->master.caps & CAP_PLAYBACK_SWITCH)) return;
 
     snd_mixer_selem_set_playback_switch_all (vol->master_element, mute ? 0 : 1);
 }
@@ -795,22 +1177,125 @@ static void asound_set_mute (VolumeALSAPlugin *vol, gboolean mute)
  * This implementation returns the average of the Front Left and Front Right channels. */
 static int asound_get_volume (VolumeALSAPlugin *vol)
 {
-    if (vol->master_element == NULL || snd_mixer_elem_get_type (vol->master_element) != SND_MIXER_ELEM_SIMPLE) return 0;
-    if (!snd_mixer_selem_has_playback_channel (vol->master_element, SND_MIXER_SCHN_FRONT_LEFT)) return 0;
-    if (!snd_mixer_selem_has_playback_volume (vol->master_element)) return 0;
+    if (!(vol->master.caps & CAP_PLAYBACK_VOLUME) || !(vol->master.channels & (1u << SND_MIXER_SCHN_FRONT_LEFT))) return 0;
 
-    return get_normalized_volume (vol->master_element, FALSE);
+    return curve_get_volume (vol->master_element, vol->master.curve, FALSE);
 }
 
 /* Set the volume to the sound system.
  * This implementation sets the Front Left and Front Right channels to the specified value. */
 static void asound_set_volume (VolumeALSAPlugin *vol, int volume)
 {
-    if (vol->master_element == NULL || snd_mixer_elem_get_type (vol->master_element) != SND_MIXER_ELEM_SIMPLE) return;
-    if (!snd_mixer_selem_has_playback_channel (vol->master_element, SND_MIXER_SCHN_FRONT_LEFT)) return;
-    if (!snd_mixer_selem_has_playback_volume (vol->master_element)) return;
+    if (!(vol->master.caps & CAP_PLAYBACK_VOLUME) || !(vol->master.channels & (1u << SND_MIXER_SCHN_FRONT_LEFT))) return;
+
+    curve_set_volume (vol->master_element, vol->master.curve, volume, FALSE);
+}
+
+/* Volume fades - the master volume is moved to a target over a given time. Steps are taken
+ * evenly along the percentage shown on the slider, so the fade follows the same perceptual
+ * curve as the slider rather than being linear in dB.
+ * Starting a new fade, or setting the volume directly, cancels any fade already in progress. */
+
+static void asound_fade_volume (VolumeALSAPlugin *vol, int volume, int ms)
+{
+    asound_fade_cancel (vol);
+    if (!(vol->master.caps & CAP_PLAYBACK_VOLUME)) return;
+
+    asound_fade_start (vol, asound_get_volume (vol), volume, ms);
+}
+
+/* Mute and unmute by fading the volume down before the switch is turned off, and up after
+ * it is turned on. The volume is restored while muted, so it is unchanged after unmuting. */
+static void asound_fade_mute (VolumeALSAPlugin *vol, gboolean mute)
+{
+    int volume;
+
+    if (!(vol->master.caps & CAP_PLAYBACK_SWITCH) || !(vol->master.caps & CAP_PLAYBACK_VOLUME) || vol->mute_fade_time == 0)
+    {
+        asound_fade_cancel (vol);
+        asound_set_mute (vol, mute);
+        return;
+    }
+
+    if (mute)
+    {
+        if (vol->fade_mute || asound_is_muted (vol)) return;
+
+        volume = vol->fade_timer ? vol->fade_to : asound_get_volume (vol);
+        asound_fade_volume (vol, 0, vol->mute_fade_time);
+        if (vol->fade_timer)
+        {
+            vol->fade_mute = TRUE;
+            vol->fade_restore = volume;
+        }
+        else asound_set_mute (vol, TRUE);
+    }
+    else if (vol->fade_mute)
+    {
+        /* still fading down - just fade back up again */
+        asound_fade_volume (vol, vol->fade_restore, vol->mute_fade_time);
+    }
+    else if (asound_is_muted (vol))
+    {
+        asound_fade_cancel (vol);
+        volume = asound_get_volume (vol);
+        asound_set_volume (vol, 0);
+        asound_set_mute (vol, FALSE);
+        asound_fade_start (vol, 0, volume, vol->mute_fade_time);
+    }
+}
+
+static void asound_fade_start (VolumeALSAPlugin *vol, int from, int to, int ms)
+{
+    if (ms <= 0 || from == to)
+    {
+        asound_set_volume (vol, to);
+        return;
+    }
+
+    DEBUG ("Fading volume from %d to %d over %d ms", from, to, ms);
+    vol->fade_start = g_get_monotonic_time ();
+    vol->fade_time = ms;
+    vol->fade_from = from;
+    vol->fade_to = to;
+    vol->fade_level = from;
+    vol->fade_timer = g_timeout_add (FADE_INTERVAL, asound_fade_step, vol);
+}
+
+static void asound_fade_cancel (VolumeALSAPlugin *vol)
+{
+    if (vol->fade_timer) g_source_remove (vol->fade_timer);
+    vol->fade_timer = 0;
+    vol->fade_mute = FALSE;
+}
+
+static gboolean asound_fade_step (gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    gint64 elapsed = (g_get_monotonic_time () - vol->fade_start) / 1000;
+    int volume;
+
+    if (elapsed >= vol->fade_time)
+    {
+        vol->fade_timer = 0;
+        asound_set_volume (vol, vol->fade_to);
+        if (vol->fade_mute)
+        {
+            asound_set_mute (vol, TRUE);
+            asound_set_volume (vol, vol->fade_restore);
+            vol->fade_mute = FALSE;
+        }
+        volumealsa_queue_update_display (vol);
+        return G_SOURCE_REMOVE;
+    }
 
-    set_normalized_volume (vol->master_element, volume, volume - asound_get_volume (vol), FALSE);
+    volume = vol->fade_from + (vol->fade_to - vol->fade_from) * elapsed / vol->fade_time;
+    if (volume != vol->fade_level)
+    {
+        asound_set_volume (vol, volume);
+        vol->fade_level = volume;
+    }
+    return G_SOURCE_CONTINUE;
 }
 
 
@@ -828,9 +1313,9 @@ static gboolean asound_initialize (VolumeALSAPlugin *vol)
     DEBUG ("Initializing...");
 
     /* if the default device is a Bluetooth device, check it is actually connected... */
-    if (asound_get_default_card () == BLUEALSA_DEV)
+    if (asound_get_default_card (vol) == BLUEALSA_DEV)
     {
-        char *btdev = asound_get_bt_device ();
+        char *btdev = asound_get_bt_device (vol);
         gboolean res = bt_is_connected (vol, btdev);
         g_free (btdev);
         if (!res)
@@ -860,12 +1345,8 @@ static gboolean asound_initialize (VolumeALSAPlugin *vol)
 static void asound_deinitialize (VolumeALSAPlugin *vol)
 {
     DEBUG ("Deinitializing...");
-    if (vol->mixer_evt_idle != 0)
-    {
-        g_source_remove (vol->mixer_evt_idle);
-        vol->mixer_evt_idle = 0;
-    }
-    vol->master_element = NULL;
+    asound_fade_cancel (vol);
+    asound_set_master_elem (vol, NULL);
     asound_mixer_deinitialize (vol, OUTPUT_MIXER);
 }
 
@@ -895,7 +1376,7 @@ static gboolean asound_find_master_elem (VolumeALSAPlugin *vol)
         if (snd_mixer_selem_is_active (elem) && snd_mixer_selem_has_playback_volume (elem) && snd_mixer_selem_has_playback_switch (elem))
         {
             DEBUG ("Device (vol and switch) attached successfully");
-            vol->master_element = elem;
+            asound_set_master_elem (vol, elem);
             return TRUE;
         }
     }
@@ -905,7 +1386,7 @@ static gboolean asound_find_master_elem (VolumeALSAPlugin *vol)
         if (snd_mixer_selem_is_active (elem) && snd_mixer_selem_has_playback_volume (elem))
         {
             DEBUG ("Device (vol only) attached successfully");
-            vol->master_element = elem;
+            asound_set_master_elem (vol, elem);
             return TRUE;
         }
     }
@@ -913,18 +1394,39 @@ static gboolean asound_find_master_elem (VolumeALSAPlugin *vol)
     return FALSE;
 }
 
+/* Set the master element, and record its capabilities so they need not be queried on every access */
+static void asound_set_master_elem (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem)
+{
+    elem_info_t *info;
+    int chan;
+
+    vol->master_element = elem;
+    memset (&vol->master, 0, sizeof (master_info_t));
+    if (!elem) return;
+
+    if (snd_mixer_selem_has_playback_volume (elem)) vol->master.caps |= CAP_PLAYBACK_VOLUME;
+    if (snd_mixer_selem_has_playback_switch (elem)) vol->master.caps |= CAP_PLAYBACK_SWITCH;
+    for (chan = SND_MIXER_SCHN_FRONT_LEFT; chan <= SND_MIXER_SCHN_LAST; chan++)
+        if (snd_mixer_selem_has_playback_channel (elem, chan)) vol->master.channels |= 1u << chan;
+
+    info = (elem_info_t *) snd_mixer_elem_get_callback_private (elem);
+    if (info) vol->master.curve = info->curves[0];
+}
+
 static gboolean asound_mixer_initialize (VolumeALSAPlugin *vol, MixerIO io)
 {
-    char *device = io ? asound_default_input_name () : asound_default_device_name ();
+    char *device = io ? asound_default_input_name (vol) : asound_default_device_name (vol);
     snd_mixer_t *mixer;
-    struct pollfd *fds;
-    int nchans, i;
     gboolean res = FALSE;
 
     DEBUG ("Attaching mixer to %s device %s...", io ? "input" : "output", device);
 
     vol->mixers[io].mixer = NULL;
 
+    // reuse a mixer which is still open if there is one
+    mixer = asound_pool_get (vol, device);
+    if (mixer) goto attached;
+
     // create and attach the mixer
     if (snd_mixer_open (&mixer, 0)) goto end;
 
@@ -934,29 +1436,26 @@ static gboolean asound_mixer_initialize (VolumeALSAPlugin *vol, MixerIO io)
         goto end;
     }
 
+    /* set up each element as it is added */
+    snd_mixer_set_callback (mixer, asound_mixer_elem_added);
+    snd_mixer_set_callback_private (mixer, vol);
+
     if (snd_mixer_selem_register (mixer, NULL, NULL) || snd_mixer_load (mixer))
     {
-        snd_mixer_detach (mixer, device);
-        snd_mixer_close (mixer);
+        asound_mixer_close (mixer, device);
         goto end;
     }
 
+attached:
     vol->mixers[io].mixer = mixer;
+    vol->mixers[io].device = device;
+    vol->mixers[io].failed = FALSE;
+    device = NULL;
 
     /* listen for ALSA events on the mixer */
-    nchans = snd_mixer_poll_descriptors_count (mixer);
-    vol->mixers[io].num_channels = nchans;
-    vol->mixers[io].channels = g_new0 (GIOChannel *, nchans);
-    vol->mixers[io].watches = g_new0 (guint, nchans);
-
-    fds = g_new0 (struct pollfd, nchans);
-    snd_mixer_poll_descriptors (mixer, fds, nchans);
-    for (i = 0; i < nchans; ++i)
-    {
-        vol->mixers[io].channels[i] = g_io_channel_unix_new (fds[i].fd);
-        vol->mixers[io].watches[i] = g_io_add_watch (vol->mixers[io].channels[i], G_IO_IN | G_IO_HUP, asound_mixer_event, vol);
-    }
-    g_free (fds);
+    vol->mixers[io].source = asound_mixer_source_new (mixer);
+    g_source_set_callback (vol->mixers[io].source, (GSourceFunc) asound_mixer_event, vol, NULL);
+    g_source_attach (vol->mixers[io].source, NULL);
     res = TRUE;
 
 end:
@@ -966,161 +1465,629 @@ end:
 
 static void asound_mixer_deinitialize (VolumeALSAPlugin *vol, MixerIO io)
 {
-    char *device = io ? asound_default_input_name () : asound_default_device_name ();
-    int i;
+    DEBUG ("Detaching mixer from %s device %s...", io ? "input" : "output", vol->mixers[io].device);
 
-    DEBUG ("Detaching mixer from %s device %s...", io ? "input" : "output", device);
-
-    for (i = 0; i < vol->mixers[io].num_channels; i++)
+    /* the options dialog reads its tabs from the mixer as they are shown, so it cannot outlive it */
+    if (vol->options_dlg && vol->mixers[io].mixer && vol->options_mixer == vol->mixers[io].mixer)
     {
-        g_source_remove (vol->mixers[io].watches[i]);
-        g_io_channel_shutdown (vol->mixers[io].channels[i], FALSE, NULL);
-        g_io_channel_unref (vol->mixers[io].channels[i]);
+        DEBUG ("Closing options dialog for mixer");
+        close_options (vol);
     }
 
-    g_free (vol->mixers[io].channels);
-    g_free (vol->mixers[io].watches);
-    vol->mixers[io].channels = NULL;
-    vol->mixers[io].watches = NULL;
-    vol->mixers[io].num_channels = 0;
+    if (vol->mixers[io].source)
+    {
+        g_source_destroy (vol->mixers[io].source);
+        g_source_unref (vol->mixers[io].source);
+        vol->mixers[io].source = NULL;
+    }
 
     if (vol->mixers[io].mixer)
     {
-        snd_mixer_detach (vol->mixers[io].mixer, device);
-        snd_mixer_close (vol->mixers[io].mixer);
+        /* keep the mixer open in case the device is used again, unless it has failed */
+        if (!vol->mixers[io].failed) asound_pool_put (vol, vol->mixers[io].mixer, vol->mixers[io].device);
+        else asound_mixer_close (vol->mixers[io].mixer, vol->mixers[io].device);
     }
     vol->mixers[io].mixer = NULL;
 
-    g_free (device);
+    g_free (vol->mixers[io].device);
+    vol->mixers[io].device = NULL;
 }
 
-static gboolean asound_current_dev_check (VolumeALSAPlugin *vol)
+static void asound_mixer_close (snd_mixer_t *mixer, const char *device)
 {
-    if (!vsystem ("amixer info 2>/dev/null | grep -q .")) return TRUE;
-    else
-    {
-        asound_deinitialize (vol);
-        asound_set_default_card (-1);
-        return FALSE;
-    }
+    asound_mixer_free_elems (mixer);
+    snd_mixer_detach (mixer, device);
+    snd_mixer_close (mixer);
 }
 
-static gboolean asound_has_volume_control (int dev)
-{
-    if (dev == -1)
-        return vsystem ("amixer scontents 2>/dev/null | grep -q pvolume") ? FALSE : TRUE;
-    else
-        return vsystem ("amixer -c %d scontents 2>/dev/null | grep -q pvolume", dev) ? FALSE : TRUE;
-}
-
-static gboolean asound_has_input (int dev)
-{
-    return vsystem ("amixer -c %d scontents 2>/dev/null | grep -q cvolume", dev) ? FALSE : TRUE;
-}
-
-/* NOTE by PCMan:
- * This is magic! Since ALSA uses its own machanism to handle this part.
- * After polling of mixer fds, it requires that we should call
- * snd_mixer_handle_events to clear all pending mixer events.
- * However, when using the glib IO channels approach, we don't have
- * poll() and snd_mixer_poll_descriptors_revents(). Due to the design of
- * glib, on_mixer_event() will be called for every fd whose status was
- * changed. So, after each poll(), it's called for several times,
- * not just once. Therefore, we cannot call snd_mixer_handle_events()
- * directly in the event handler. Otherwise, it will get called for
- * several times, which might clear unprocessed pending events in the queue.
- * So, here we call it once in the event callback for the first fd.
- * Then, we don't call it for the following fds. After all fds with changed
- * status are handled, we remove this restriction in an idle handler.
- * The next time the event callback is involked for the first fs, we can
- * call snd_mixer_handle_events() again. Racing shouldn't happen here
- * because the idle handler has the same priority as the io channel callback.
- * So, io callbacks for future pending events should be in the next gmain
- * iteration, and won't be affected.
- */
+/* Mixers for recently used devices are kept open in a small pool, along with their element data,
+ * so that switching back to a device does not need its mixer to be reloaded. Only hardware
+ * devices are pooled, as Bluetooth devices can disappear at any time. The pool is flushed
+ * when cards are added or removed, as card numbers may then refer to different devices. */
 
-static gboolean asound_restart (gpointer user_data)
+static snd_mixer_t *asound_pool_get (VolumeALSAPlugin *vol, const char *device)
 {
-    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
-
-    if (!g_main_current_source ()) return TRUE;
-    if (g_source_is_destroyed (g_main_current_source ())) return FALSE;
+    pooled_mixer_t *pm;
+    snd_mixer_t *mixer;
+    GList *l;
 
-    if (!asound_initialize (vol))
+    for (l = vol->mixer_pool; l; l = l->next)
     {
-        g_warning ("volumealsa: Re-initialization failed.");
-        return TRUE; // try again in a second
-    }
+        pm = (pooled_mixer_t *) l->data;
+        if (!g_strcmp0 (pm->device, device))
+        {
+            mixer = pm->mixer;
+            vol->mixer_pool = g_list_delete_link (vol->mixer_pool, l);
 
-    g_warning ("volumealsa: Restarted ALSA interface...");
-    volumealsa_update_display (vol);
+            /* catch up with any changes made while the mixer was in the pool */
+            if (snd_mixer_handle_events (mixer) < 0)
+            {
+                DEBUG ("Pooled mixer for %s failed", device);
+                asound_mixer_close (mixer, pm->device);
+                mixer = NULL;
+            }
+            else DEBUG ("Reusing pooled mixer for %s", device);
 
-    vol->restart_idle = 0;
-    return FALSE;
+            g_free (pm->device);
+            g_free (pm);
+            return mixer;
+        }
+    }
+    return NULL;
 }
 
-static gboolean asound_reset_mixer_evt_idle (gpointer user_data)
+static void asound_pool_put (VolumeALSAPlugin *vol, snd_mixer_t *mixer, const char *device)
 {
-    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    pooled_mixer_t *pm;
+    GList *l;
 
-    if (!g_source_is_destroyed (g_main_current_source ()))
-        vol->mixer_evt_idle = 0;
-    return FALSE;
+    if (!g_str_has_prefix (device, "hw:"))
+    {
+        asound_mixer_close (mixer, device);
+        return;
+    }
+
+    pm = g_new0 (pooled_mixer_t, 1);
+    pm->mixer = mixer;
+    pm->device = g_strdup (device);
+    vol->mixer_pool = g_list_prepend (vol->mixer_pool, pm);
+
+    /* close the least recently used mixer if the pool is full */
+    if (g_list_length (vol->mixer_pool) > MIXER_POOL_SIZE)
+    {
+        l = g_list_last (vol->mixer_pool);
+        pm = (pooled_mixer_t *) l->data;
+        asound_mixer_close (pm->mixer, pm->device);
+        g_free (pm->device);
+        g_free (pm);
+        vol->mixer_pool = g_list_delete_link (vol->mixer_pool, l);
+    }
 }
 
-/* Handler for I/O event on ALSA channel. */
-static gboolean asound_mixer_event (GIOChannel *channel, GIOCondition cond, gpointer user_data)
+static void asound_pool_flush (VolumeALSAPlugin *vol)
 {
-    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
-    int i, res = 0;
-    snd_mixer_t *mixer = NULL;
+    pooled_mixer_t *pm;
+    GList *l;
 
-    if (g_source_is_destroyed (g_main_current_source ())) return FALSE;
+    for (l = vol->mixer_pool; l; l = l->next)
+    {
+        pm = (pooled_mixer_t *) l->data;
+        asound_mixer_close (pm->mixer, pm->device);
+        g_free (pm->device);
+        g_free (pm);
+    }
+    g_list_free (vol->mixer_pool);
+    vol->mixer_pool = NULL;
+}
+
+/* Handler for an element being added to a mixer - called from snd_mixer_load and snd_mixer_handle_events */
+static int asound_mixer_elem_added (snd_mixer_t *mixer, unsigned int mask, snd_mixer_elem_t *elem)
+{
+    elem_info_t *info;
+
+    if (!(mask & SND_CTL_EVENT_MASK_ADD)) return 0;
+
+    info = g_new0 (elem_info_t, 1);
+    info->vol = (VolumeALSAPlugin *) snd_mixer_get_callback_private (mixer);
+    asound_elem_build_curves (info, elem);
+
+    snd_mixer_elem_set_callback (elem, asound_elem_event);
+    snd_mixer_elem_set_callback_private (elem, info);
+    return 0;
+}
 
-    if (vol->mixer_evt_idle == 0)
+/* Handler for a change to an element - called from snd_mixer_handle_events */
+static int asound_elem_event (snd_mixer_elem_t *elem, unsigned int mask)
+{
+    elem_info_t *info = (elem_info_t *) snd_mixer_elem_get_callback_private (elem);
+
+    if (!info) return 0;
+
+    if (mask == SND_CTL_EVENT_MASK_REMOVE)
     {
-        if (vol->mixers[OUTPUT_MIXER].mixer)
+        if (elem == info->vol->master_element) asound_set_master_elem (info->vol, NULL);
+        asound_elem_free (elem);
+        return 0;
+    }
+
+    /* controls can be added to an existing element, which may change its ranges */
+    if (mask & SND_CTL_EVENT_MASK_INFO)
+    {
+        asound_elem_build_curves (info, elem);
+        if (elem == info->vol->master_element) asound_set_master_elem (info->vol, elem);
+    }
+
+    if ((mask & SND_CTL_EVENT_MASK_VALUE) && info->vol->options_dlg) update_options (info->vol, elem);
+    return 0;
+}
+
+static void asound_elem_build_curves (elem_info_t *info, snd_mixer_elem_t *elem)
+{
+    g_free (info->curves[0]);
+    g_free (info->curves[1]);
+    info->curves[0] = build_volume_curve (elem, FALSE);
+    info->curves[1] = build_volume_curve (elem, TRUE);
+}
+
+static void asound_elem_free (snd_mixer_elem_t *elem)
+{
+    elem_info_t *info = (elem_info_t *) snd_mixer_elem_get_callback_private (elem);
+
+    if (info)
+    {
+        g_free (info->curves[0]);
+        g_free (info->curves[1]);
+        g_free (info);
+    }
+    snd_mixer_elem_set_callback (elem, NULL);
+    snd_mixer_elem_set_callback_private (elem, NULL);
+}
+
+/* Free the element data before detaching, as removing elements on closing the mixer does not call their handlers */
+static void asound_mixer_free_elems (snd_mixer_t *mixer)
+{
+    snd_mixer_elem_t *elem;
+
+    for (elem = snd_mixer_first_elem (mixer); elem != NULL; elem = snd_mixer_elem_next (elem))
+        asound_elem_free (elem);
+}
+
+/* Check that the default device is valid - if the output mixer is attached to it and running, it is,
+ * otherwise try to open its control interface */
+static gboolean asound_current_dev_check (VolumeALSAPlugin *vol)
+{
+    snd_ctl_t *ctl;
+
+    if (vol->mixers[OUTPUT_MIXER].mixer && !vol->stopped) return TRUE;
+
+    if (!snd_ctl_open (&ctl, "default", 0))
+    {
+        snd_ctl_close (ctl);
+        return TRUE;
+    }
+    else
+    {
+        asound_deinitialize (vol);
+        asound_set_default_card (vol, -1);
+        return FALSE;
+    }
+}
+
+/* Find which types of control are available on a card.
+ * Returns a combination of CardCaps flags. */
+static guint asound_get_caps (int dev)
+{
+    char *device = g_strdup_printf ("hw:%d", dev);
+    snd_mixer_elem_t *elem;
+    snd_mixer_t *mixer;
+    guint caps = 0;
+
+    if (!snd_mixer_open (&mixer, 0))
+    {
+        if (!snd_mixer_attach (mixer, device))
         {
-            for (i = 0; i < vol->mixers[OUTPUT_MIXER].num_channels; i++)
+            if (!snd_mixer_selem_register (mixer, NULL, NULL) && !snd_mixer_load (mixer))
             {
-                if (channel == vol->mixers[OUTPUT_MIXER].channels[i])
+                for (elem = snd_mixer_first_elem (mixer); elem != NULL; elem = snd_mixer_elem_next (elem))
                 {
-                    mixer = vol->mixers[OUTPUT_MIXER].mixer;
-                    DEBUG ("Output mixer event");
+                    if (snd_mixer_selem_has_playback_volume (elem)) caps |= CAP_PLAYBACK_VOLUME;
+                    if (snd_mixer_selem_has_playback_switch (elem)) caps |= CAP_PLAYBACK_SWITCH;
+                    if (snd_mixer_selem_has_capture_volume (elem)) caps |= CAP_CAPTURE_VOLUME;
+                    if (snd_mixer_selem_has_capture_switch (elem)) caps |= CAP_CAPTURE_SWITCH;
                 }
             }
+            snd_mixer_detach (mixer, device);
         }
-        if (mixer == NULL && vol->mixers[INPUT_MIXER].mixer)
+        snd_mixer_close (mixer);
+    }
+
+    DEBUG ("Device %s has capabilities 0x%x", device, caps);
+    g_free (device);
+    return caps;
+}
+
+/* Get the capabilities of the default output device without opening a new mixer - from
+ * the elements of the output mixer if it is open, otherwise from the card table */
+static guint asound_default_caps (VolumeALSAPlugin *vol)
+{
+    snd_mixer_elem_t *elem;
+    card_info_t *card;
+    guint caps = 0;
+    int i, num;
+
+    if (vol->mixers[OUTPUT_MIXER].mixer)
+    {
+        for (elem = snd_mixer_first_elem (vol->mixers[OUTPUT_MIXER].mixer); elem != NULL; elem = snd_mixer_elem_next (elem))
         {
-            for (i = 0; i < vol->mixers[INPUT_MIXER].num_channels; i++)
-            {
-                if (channel == vol->mixers[INPUT_MIXER].channels[i])
-                {
-                    mixer = vol->mixers[INPUT_MIXER].mixer;
-                    DEBUG ("Input mixer event");
-                }
-            }
+            if (snd_mixer_selem_has_playback_volume (elem)) caps |= CAP_PLAYBACK_VOLUME;
+            if (snd_mixer_selem_has_playback_switch (elem)) caps |= CAP_PLAYBACK_SWITCH;
+            if (snd_mixer_selem_has_capture_volume (elem)) caps |= CAP_CAPTURE_VOLUME;
+            if (snd_mixer_selem_has_capture_switch (elem)) caps |= CAP_CAPTURE_SWITCH;
+        }
+        return caps;
+    }
+
+    num = asound_get_default_card (vol);
+    for (i = 0; i < vol->cards->len; i++)
+    {
+        card = &g_array_index (vol->cards, card_info_t, i);
+        if (card->num == num) return card->caps;
+    }
+    return 0;
+}
+
+/* The table of sound cards is built when the plugin starts, and then only updated
+ * when cards are added or removed, rather than being probed every time it is used. */
+
+static void asound_build_card_table (VolumeALSAPlugin *vol)
+{
+    snd_ctl_card_info_t *info;
+    snd_ctl_t *ctl;
+    card_info_t card;
+    char *device;
+    gint64 start = stat_start ();
+    int num = -1;
+
+    asound_free_card_table (vol);
+    vol->cards = g_array_new (FALSE, TRUE, sizeof (card_info_t));
+
+    snd_ctl_card_info_alloca (&info);
+    while (1)
+    {
+        if (snd_card_next (&num) < 0)
+        {
+            g_warning ("volumealsa: Cannot enumerate devices");
+            break;
         }
-        if (mixer)
+        if (num == -1) break;
+
+        memset (&card, 0, sizeof (card_info_t));
+        card.num = num;
+        if (snd_card_get_name (num, &card.name)) card.name = g_strdup ("");
+
+        device = g_strdup_printf ("hw:%d", num);
+        if (!snd_ctl_open (&ctl, device, 0))
+        {
+            if (!snd_ctl_card_info (ctl, info)) card.id = g_strdup (snd_ctl_card_info_get_id (info));
+            snd_ctl_close (ctl);
+        }
+        g_free (device);
+
+        card.bcm = asound_is_bcm_device (card.name);
+        card.caps = asound_get_caps (num);
+        DEBUG ("Card %d : %s (%s)", card.num, card.name, card.id);
+        g_array_append_val (vol->cards, card);
+    }
+
+    asound_route_open (vol);
+    stat_end (vol, G_STRFUNC, start);
+}
+
+static void asound_free_card_table (VolumeALSAPlugin *vol)
+{
+    card_info_t *card;
+    int i;
+
+    if (!vol->cards) return;
+
+    for (i = 0; i < vol->cards->len; i++)
+    {
+        card = &g_array_index (vol->cards, card_info_t, i);
+        g_free (card->id);
+        g_free (card->name);
+    }
+    g_array_free (vol->cards, TRUE);
+    vol->cards = NULL;
+}
+
+/* Check for an analog output jack - go by the board model, as the firmware creates an internal
+ * analog card even on boards which do not have the jack fitted. */
+static gboolean asound_has_analog (void)
+{
+    const char *nojack[] = { "Raspberry Pi Zero", "Raspberry Pi Compute Module", "Raspberry Pi 400", "Raspberry Pi 5", NULL };
+    char *model;
+    int i;
+
+    /* can't read the model, so assume there is a jack... */
+    if (!g_file_get_contents ("/proc/device-tree/model", &model, NULL, NULL)) return TRUE;
+
+    for (i = 0; nojack[i]; i++)
+    {
+        if (g_str_has_prefix (model, nojack[i]))
         {
-            vol->mixer_evt_idle = g_idle_add_full (G_PRIORITY_DEFAULT, (GSourceFunc) asound_reset_mixer_evt_idle, vol, NULL);
-            res = snd_mixer_handle_events (mixer);
+            g_free (model);
+            return FALSE;
         }
-        else return TRUE;
     }
+    g_free (model);
+    return TRUE;
+}
+
+static gboolean asound_update_card_table (gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+
+    DEBUG ("Sound cards changed");
+    asound_build_card_table (vol);
+    asound_pool_flush (vol);
+    volumealsa_queue_device_menu (vol);
+
+    vol->cards_idle = 0;
+    return FALSE;
+}
+
+/* Handler for changes to the ALSA device nodes - each card has a single control device */
+static void asound_cards_changed (GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent evt, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    char *name;
+
+    if (evt != G_FILE_MONITOR_EVENT_CREATED && evt != G_FILE_MONITOR_EVENT_DELETED) return;
+
+    name = g_file_get_basename (file);
+    if (g_str_has_prefix (name, "controlC"))
+    {
+        /* wait for the rest of the device nodes to be created and their permissions to be set */
+        if (vol->cards_idle) g_source_remove (vol->cards_idle);
+        vol->cards_idle = g_timeout_add (500, asound_update_card_table, vol);
+    }
+    g_free (name);
+}
+
+/* The legacy internal device has a single card with a control (numid 3) to select the output -
+ * 0 = auto, 1 = analog, 2 = HDMI 1, 3 = HDMI 2. The card's control interface is kept open and
+ * the current value is cached, being updated from control events. */
+
+#define ROUTE_NUMID 3
+
+static void asound_route_open (VolumeALSAPlugin *vol)
+{
+    struct pollfd pfd;
+    char *device;
+    int i;
+
+    asound_route_close (vol);
+
+    for (i = 0; i < vol->cards->len; i++)
+        if (g_array_index (vol->cards, card_info_t, i).bcm == 1) break;
+    if (i == vol->cards->len) return;
+
+    device = g_strdup_printf ("hw:%d", g_array_index (vol->cards, card_info_t, i).num);
+    if (snd_ctl_open (&vol->route_ctl, device, SND_CTL_NONBLOCK))
+    {
+        g_warning ("volumealsa: Cannot open control interface on %s", device);
+        vol->route_ctl = NULL;
+        g_free (device);
+        return;
+    }
+    g_free (device);
+
+    vol->route = asound_route_read (vol);
+
+    if (!snd_ctl_subscribe_events (vol->route_ctl, 1) && snd_ctl_poll_descriptors (vol->route_ctl, &pfd, 1) == 1)
+    {
+        vol->route_channel = g_io_channel_unix_new (pfd.fd);
+        vol->route_watch = g_io_add_watch (vol->route_channel, G_IO_IN | G_IO_HUP, asound_route_event, vol);
+    }
+}
+
+static void asound_route_close (VolumeALSAPlugin *vol)
+{
+    if (vol->route_watch) g_source_remove (vol->route_watch);
+    vol->route_watch = 0;
+
+    if (vol->route_channel) g_io_channel_unref (vol->route_channel);
+    vol->route_channel = NULL;
+
+    if (vol->route_ctl) snd_ctl_close (vol->route_ctl);
+    vol->route_ctl = NULL;
+    vol->route = -1;
+}
+
+static int asound_route_read (VolumeALSAPlugin *vol)
+{
+    snd_ctl_elem_value_t *val;
 
-    /* the status of mixer is changed. update of display is needed. */
-    if (cond & G_IO_IN && res >= 0) volumealsa_update_display (vol);
+    if (!vol->route_ctl) return -1;
+
+    snd_ctl_elem_value_alloca (&val);
+    snd_ctl_elem_value_set_numid (val, ROUTE_NUMID);
+    if (snd_ctl_elem_read (vol->route_ctl, val)) return -1;
+
+    return snd_ctl_elem_value_get_integer (val, 0);
+}
 
-    if ((cond & G_IO_HUP) || (res < 0))
+static void asound_route_write (VolumeALSAPlugin *vol, int route)
+{
+    snd_ctl_elem_value_t *val;
+
+    if (!vol->route_ctl) return;
+
+    snd_ctl_elem_value_alloca (&val);
+    snd_ctl_elem_value_set_numid (val, ROUTE_NUMID);
+    snd_ctl_elem_value_set_integer (val, 0, route);
+    if (snd_ctl_elem_write (vol->route_ctl, val) < 0)
+        g_warning ("volumealsa: Cannot set output route");
+    else vol->route = route;
+}
+
+/* Handler for I/O event on the legacy internal device control interface */
+static gboolean asound_route_event (GIOChannel *channel, GIOCondition cond, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    snd_ctl_event_t *event;
+
+    if (cond & G_IO_HUP)
+    {
+        /* card has gone away - the hotplug handler will reopen it if it comes back */
+        vol->route_watch = 0;
+        asound_route_close (vol);
+        return FALSE;
+    }
+
+    snd_ctl_event_alloca (&event);
+    while (snd_ctl_read (vol->route_ctl, event) > 0)
+    {
+        if (snd_ctl_event_get_type (event) == SND_CTL_EVENT_ELEM && snd_ctl_event_elem_get_numid (event) == ROUTE_NUMID)
+        {
+            vol->route = asound_route_read (vol);
+            DEBUG ("Output route changed to %d", vol->route);
+            volumealsa_queue_device_menu (vol);
+        }
+    }
+    return TRUE;
+}
+
+static gboolean asound_restart (gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+
+    if (!g_main_current_source ()) return TRUE;
+    if (g_source_is_destroyed (g_main_current_source ())) return FALSE;
+
+    if (!asound_initialize (vol))
+    {
+        g_warning ("volumealsa: Re-initialization failed.");
+        return TRUE; // try again in a second
+    }
+
+    g_warning ("volumealsa: Restarted ALSA interface...");
+    volumealsa_update_display (vol);
+
+    vol->restart_idle = 0;
+    return FALSE;
+}
+
+/* The mixer's poll descriptors are all handled by a single source, so snd_mixer_handle_events is
+ * called exactly once for each wakeup, however many of the descriptors are ready. */
+
+static GSourceFuncs asound_mixer_source_funcs = {
+    asound_mixer_source_prepare,
+    asound_mixer_source_check,
+    asound_mixer_source_dispatch,
+    asound_mixer_source_finalize
+};
+
+static GSource *asound_mixer_source_new (snd_mixer_t *mixer)
+{
+    GSource *source = g_source_new (&asound_mixer_source_funcs, sizeof (mixer_source_t));
+    mixer_source_t *msrc = (mixer_source_t *) source;
+    int i;
+
+    msrc->mixer = mixer;
+    msrc->nfds = snd_mixer_poll_descriptors_count (mixer);
+    if (msrc->nfds < 0) msrc->nfds = 0;
+    msrc->pfds = g_new0 (struct pollfd, msrc->nfds);
+    msrc->fds = g_new0 (GPollFD, msrc->nfds);
+    snd_mixer_poll_descriptors (mixer, msrc->pfds, msrc->nfds);
+
+    for (i = 0; i < msrc->nfds; i++)
+    {
+        msrc->fds[i].fd = msrc->pfds[i].fd;
+        msrc->fds[i].events = msrc->pfds[i].events | G_IO_HUP | G_IO_ERR;
+        g_source_add_poll (source, &msrc->fds[i]);
+    }
+    return source;
+}
+
+static gboolean asound_mixer_source_prepare (GSource *source, gint *timeout)
+{
+    *timeout = -1;
+    return FALSE;
+}
+
+static gboolean asound_mixer_source_check (GSource *source)
+{
+    mixer_source_t *msrc = (mixer_source_t *) source;
+    int i;
+
+    for (i = 0; i < msrc->nfds; i++)
+        if (msrc->fds[i].revents) return TRUE;
+    return FALSE;
+}
+
+static gboolean asound_mixer_source_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    mixer_source_t *msrc = (mixer_source_t *) source;
+    unsigned short revents = 0;
+    int i;
+
+    if (!callback) return FALSE;
+
+    for (i = 0; i < msrc->nfds; i++)
+    {
+        msrc->pfds[i].revents = msrc->fds[i].revents;
+        msrc->fds[i].revents = 0;
+    }
+    if (snd_mixer_poll_descriptors_revents (msrc->mixer, msrc->pfds, msrc->nfds, &revents) < 0) revents = POLLERR;
+
+    return ((MixerSourceFunc) callback) (msrc->mixer, revents, user_data);
+}
+
+static void asound_mixer_source_finalize (GSource *source)
+{
+    mixer_source_t *msrc = (mixer_source_t *) source;
+
+    g_free (msrc->fds);
+    g_free (msrc->pfds);
+}
+
+/* Handler for events on an ALSA mixer. */
+static gboolean asound_mixer_event (snd_mixer_t *mixer, unsigned short revents, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    int res;
+
+    DEBUG ("%s mixer event", mixer == vol->mixers[INPUT_MIXER].mixer ? "Input" : "Output");
+    res = snd_mixer_handle_events (mixer);
+
+    /* the status of mixer is changed. update of display is needed, unless this is just
+     * the result of the last volume write, which has already been displayed. */
+    if ((revents & POLLIN) && res >= 0)
+    {
+        if (vol->volume_echo >= 0 && mixer == vol->mixers[OUTPUT_MIXER].mixer
+            && vol->master_element && asound_get_volume (vol) == vol->volume_echo
+            && asound_is_muted (vol) == vol->volume_echo_mute)
+        {
+            DEBUG ("Ignoring own volume change");
+        }
+        else volumealsa_queue_update_display (vol);
+        vol->volume_echo = -1;
+    }
+
+    if ((revents & (POLLHUP | POLLERR)) || (res < 0))
     {
         /* This means there're some problems with alsa. */
         g_warning ("volumealsa: ALSA (or pulseaudio) had a problem: "
                 "volumealsa: snd_mixer_handle_events() = %d,"
-                " cond 0x%x (IN: 0x%x, HUP: 0x%x).", res, cond,
-                G_IO_IN, G_IO_HUP);
+                " revents 0x%x (IN: 0x%x, HUP: 0x%x, ERR: 0x%x).", res, revents,
+                POLLIN, POLLHUP, POLLERR);
         gtk_widget_set_tooltip_text (vol->plugin, "ALSA (or pulseaudio) had a problem."
                 " Please check the lxpanel logs.");
+        vol->disp_tooltip = -1;
+
+        if (mixer == vol->mixers[OUTPUT_MIXER].mixer) vol->mixers[OUTPUT_MIXER].failed = TRUE;
+        if (mixer == vol->mixers[INPUT_MIXER].mixer) vol->mixers[INPUT_MIXER].failed = TRUE;
 
         if (vol->restart_idle == 0) vol->restart_idle = g_timeout_add_seconds (1, asound_restart, vol);
 
@@ -1135,378 +2102,526 @@ static gboolean asound_mixer_event (GIOChannel *channel, GIOCondition cond, gpoi
 /* .asoundrc manipulation                                                     */
 /*----------------------------------------------------------------------------*/
 
-static int asound_get_default_card (void)
+/* The sections of .asoundrc which are used to select the default devices */
+static const char *asound_section_names[NUM_SECTIONS] = { "pcm.!default", "pcm.output", "pcm.input", "ctl.!default" };
+
+/* Skip whitespace, separators and comments in the text of an ALSA configuration file */
+static void asound_conf_skip_space (const char **pos)
 {
-    char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
-    char *res;
-    int val;
+    const char *p = *pos;
 
-    /* does .asoundrc exist? if not, default device is 0 */
-    if (!g_file_test (user_config_file, G_FILE_TEST_IS_REGULAR))
+    while (*p)
     {
-        g_free (user_config_file);
+        if (*p == '#')
+        {
+            while (*p && *p != '\n') p++;
+        }
+        else if (g_ascii_isspace (*p) || *p == '=' || *p == ';' || *p == ',') p++;
+        else break;
+    }
+    *pos = p;
+}
+
+/* Read the next token from the text of an ALSA configuration file. Returns 'w' for
+ * a word or quoted string (which is returned in tok), a bracket character, or 0 at
+ * the end of the text. Comments and separators are skipped. */
+static char asound_conf_token (const char **pos, char **tok)
+{
+    const char *p, *start;
+    char quote;
+
+    *tok = NULL;
+    asound_conf_skip_space (pos);
+    p = *pos;
+
+    if (*p == 0)
+    {
+        *pos = p;
         return 0;
     }
 
-    /* does .asoundrc use type asym? */
-    if (find_in_section (user_config_file, "pcm.!default", "asym"))
+    if (*p == '{' || *p == '}' || *p == '[' || *p == ']')
     {
-        /* look in pcm.output section for bluealsa */
-        if (find_in_section (user_config_file, "pcm.output", "bluealsa"))
+        *pos = p + 1;
+        return *p;
+    }
+
+    if (*p == '"' || *p == '\'')
+    {
+        quote = *p++;
+        start = p;
+        while (*p && *p != quote)
         {
-            g_free (user_config_file);
-            return BLUEALSA_DEV;
+            if (*p == '\\' && p[1]) p++;
+            p++;
         }
-
-        /* otherwise parse pcm.output section for card number */
-        res = get_string ("sed -n '/pcm.output/,/}/{/card/p}' %s 2>/dev/null | grep -o 'card\\s[0-9]' | cut -d ' ' -f 2", user_config_file);
-        if (sscanf (res, "%d", &val) != 1) val = -1;
+        *tok = g_strndup (start, p - start);
+        if (*p) p++;
     }
     else
     {
-        /* first check to see if Bluetooth is in use */
-        if (find_in_section (user_config_file, "pcm.!default", "bluealsa"))
-        {
-            g_free (user_config_file);
-            return BLUEALSA_DEV;
-        }
-
-        /* if not, check for new format file */
-        res = get_string ("sed -n '/pcm.!default/,/}/{/slave.pcm/p}' %s 2>/dev/null | cut -d '\"' -f 2 | cut -d : -f 2", user_config_file);
-        if (sscanf (res, "%d", &val) == 1) goto DONE;
-        g_free (res);
-
-        /* if not, check for old format file */
-        res = get_string ("sed -n '/pcm.!default/,/}/{/card/p}' %s 2>/dev/null | grep -o 'card\\s[0-9]' | cut -d ' ' -f 2", user_config_file);
-        if (sscanf (res, "%d", &val) == 1) goto DONE;
-
-        /* nothing valid found, default device is 0 */
-        val = 0;
+        start = p;
+        while (*p && !g_ascii_isspace (*p) && !strchr ("{}[]=;,#\"'", *p)) p++;
+        *tok = g_strndup (start, p - start);
     }
 
-    DONE: g_free (res);
-    g_free (user_config_file);
-    return val;
+    *pos = p;
+    return 'w';
 }
 
-static int asound_get_default_input (void)
+/* Skip the remainder of a compound value whose opening bracket has just been read */
+static void asound_conf_skip (const char **pos)
 {
-    char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
-    char *res;
-    int val;
+    int depth = 1;
+    char *tok, type;
 
-    /* does .asoundrc exist? if not, default device is 0 */
-    if (!g_file_test (user_config_file, G_FILE_TEST_IS_REGULAR))
+    while (depth && (type = asound_conf_token (pos, &tok)))
     {
-        g_free (user_config_file);
-        return 0;
+        if (type == '{' || type == '[') depth++;
+        else if (type == '}' || type == ']') depth--;
+        g_free (tok);
     }
+}
+
+/* Read the fields of interest from the body of a section whose opening bracket has just been read */
+static void asound_conf_read_section (const char **pos, asound_section_t *sect)
+{
+    char *key, *val, type;
 
-    /* does .asoundrc use type asym? */
-    if (find_in_section (user_config_file, "pcm.!default", "asym"))
+    while ((type = asound_conf_token (pos, &key)))
     {
-        /* look in pcm.input section for bluealsa */
-        if (find_in_section (user_config_file, "pcm.input", "bluealsa"))
+        if (type == '}') return;
+        if (type != 'w')
         {
-            g_free (user_config_file);
-            return BLUEALSA_DEV;
+            if (type == '{' || type == '[') asound_conf_skip (pos);
+            continue;
         }
 
-        /* parse pcm.input section for card number */
-        res = get_string ("sed -n '/pcm.input/,/}/{/card/p}' %s 2>/dev/null | grep -o 'card\\s[0-9]' | cut -d ' ' -f 2", user_config_file);
-        if (sscanf (res, "%d", &val) != 1) val = -1;
+        type = asound_conf_token (pos, &val);
+        if (type == 'w')
+        {
+            if (!g_strcmp0 (key, "type"))
+            {
+                g_free (sect->type);
+                sect->type = val;
+            }
+            else if (!g_strcmp0 (key, "card"))
+            {
+                g_free (sect->card);
+                sect->card = val;
+            }
+            else if (!g_strcmp0 (key, "device"))
+            {
+                g_free (sect->device);
+                sect->device = val;
+            }
+            else if (!g_strcmp0 (key, "slave.pcm"))
+            {
+                g_free (sect->slave);
+                sect->slave = val;
+            }
+            else g_free (val);
+        }
+        else if (type == '{' || type == '[') asound_conf_skip (pos);
+        g_free (key);
+        if (type == '}' || type == 0) return;
     }
-    else
+}
+
+/* Parse the text of .asoundrc, filling in the sections used for default device selection.
+ * If ranges is not NULL, the location in the text of each of those sections is added to it. */
+static void asound_parse_config (const char *text, asound_section_t *sects, GArray *ranges)
+{
+    const char *pos = text, *start;
+    asound_range_t range;
+    char *name, *val, type;
+    int i;
+
+    while (1)
     {
-        /* default input device is same as output pcm device */
-        /* check for new format file */
-        res = get_string ("sed -n '/pcm.!default/,/}/{/slave.pcm/p}' %s 2>/dev/null | cut -d '\"' -f 2 | cut -d : -f 2", user_config_file);
-        if (sscanf (res, "%d", &val) == 1) goto DONE;
-        g_free (res);
+        asound_conf_skip_space (&pos);
+        start = pos;
+        if (!(type = asound_conf_token (&pos, &name))) break;
+        if (type != 'w') continue;
+
+        type = asound_conf_token (&pos, &val);
+        g_free (val);
+        if (type == '{' || type == '[')
+        {
+            for (i = 0; i < NUM_SECTIONS; i++)
+                if (type == '{' && !g_strcmp0 (name, asound_section_names[i])) break;
+
+            if (i < NUM_SECTIONS)
+            {
+                asound_conf_read_section (&pos, &sects[i]);
+                if (ranges)
+                {
+                    range.sect = i;
+                    range.start = start - text;
+                    range.end = pos - text;
+                    g_array_append_val (ranges, range);
+                }
+            }
+            else asound_conf_skip (&pos);
+        }
+        g_free (name);
+    }
+}
+
+static void asound_free_section (asound_section_t *sect)
+{
+    g_free (sect->type);
+    g_free (sect->card);
+    g_free (sect->device);
+    g_free (sect->slave);
+}
+
+/* Convert a card name or number as used in .asoundrc into a card number */
+static int asound_card_index (const char *card)
+{
+    char *end;
+    long num;
+
+    if (!card || !*card) return -1;
+
+    /* a number is taken as it is, so a card which is not plugged in keeps its index */
+    num = strtol (card, &end, 10);
+    if (end != card && *end == 0) return (num < 0 || num > G_MAXINT) ? -1 : num;
+
+    num = snd_card_get_index (card);
+    return num < 0 ? -1 : num;
+}
+
+/* Find the card number referred to by a section - either in a card field or in a slave.pcm device name */
+static int asound_section_card (asound_section_t *sect)
+{
+    char *card, *end;
+    int num;
 
-        /* if not, check for old format file */
-        res = get_string ("sed -n '/pcm.!default/,/}/{/card/p}' %s 2>/dev/null | grep -o 'card\\s[0-9]' | cut -d ' ' -f 2", user_config_file);
-        if (sscanf (res, "%d", &val) == 1) goto DONE;
+    if (!g_strcmp0 (sect->type, "bluealsa")) return BLUEALSA_DEV;
 
-        /* nothing valid found, default device is 0 */
-        val = 0;
+    if (sect->slave && (card = strchr (sect->slave, ':')))
+    {
+        card = g_strdup (card + 1);
+        if ((end = strchr (card, ','))) *end = 0;
+        num = asound_card_index (g_str_has_prefix (card, "CARD=") ? card + 5 : card);
+        g_free (card);
+        if (num != -1) return num;
     }
 
-    DONE: g_free (res);
-    g_free (user_config_file);
-    return val;
+    return asound_card_index (sect->card);
 }
 
-/* Standard text blocks used in .asoundrc for ALSA (_A) and Bluetooth (_B) devices */
-#define PREFIX      "pcm.!default {\n\ttype asym\n\tplayback.pcm {\n\t\ttype plug\n\t\tslave.pcm \"output\"\n\t}\n\tcapture.pcm {\n\t\ttype plug\n\t\tslave.pcm \"input\"\n\t}\n}"
-#define OUTPUT_A    "\npcm.output {\n\ttype hw\n\tcard %d\n}"
-#define INPUT_A     "\npcm.input {\n\ttype hw\n\tcard %d\n}"
-#define CTL_A       "\nctl.!default {\n\ttype hw\n\tcard %d\n}"
-#define OUTPUT_B    "\npcm.output {\n\ttype bluealsa\n\tdevice \"%02X:%02X:%02X:%02X:%02X:%02X\"\n\tprofile \"a2dp\"\n}"
-#define INPUT_B     "\npcm.input {\n\ttype bluealsa\n\tdevice \"%02X:%02X:%02X:%02X:%02X:%02X\"\n\tprofile \"sco\"\n}"
-#define CTL_B       "\nctl.!default {\n\ttype bluealsa\n}"
+/* Convert the Bluetooth address in a section into a BlueZ object path */
+static char *asound_section_bt_device (asound_section_t *sect)
+{
+    char *res, *ptr;
+
+    if (!sect->device || strlen (sect->device) != 17) return NULL;
 
-static void asound_set_default_card (int num)
+    res = g_strdup_printf ("/org/bluez/hci0/dev_%s", sect->device);
+    for (ptr = res; *ptr; ptr++) if (*ptr == ':') *ptr = '_';
+    return res;
+}
+
+/* Read the current default device settings from .asoundrc in a single pass */
+static void asound_read_config (asound_config_t *conf)
 {
     char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
+    asound_section_t sects[NUM_SECTIONS];
+    char *text;
+    int i;
 
-    /* does .asoundrc exist? if not, write default contents and exit */
-    if (!g_file_test (user_config_file, G_FILE_TEST_IS_REGULAR))
+    /* if there is no .asoundrc, default device is 0 */
+    memset (conf, 0, sizeof (asound_config_t));
+    if (!g_file_get_contents (user_config_file, &text, NULL, NULL))
     {
-        vsystem ("echo '" PREFIX "\n" OUTPUT_A "\n" CTL_A "' >> %s", num, num, user_config_file);
-        goto DONE;
+        g_free (user_config_file);
+        return;
     }
 
-    /* does .asoundrc use type asym? if not, replace file with default contents and exit */
-    if (!find_in_section (user_config_file, "pcm.!default", "asym"))
+    memset (sects, 0, sizeof (sects));
+    asound_parse_config (text, sects, NULL);
+    g_free (text);
+    g_free (user_config_file);
+
+    conf->exists = TRUE;
+    conf->asym = !g_strcmp0 (sects[SECTION_DEFAULT].type, "asym");
+    if (conf->asym)
     {
-        vsystem ("echo '" PREFIX "\n" OUTPUT_A "\n" CTL_A "' > %s", num, num, user_config_file);
-        goto DONE;
+        /* output and input are set by the pcm.output and pcm.input sections */
+        conf->card = asound_section_card (&sects[SECTION_OUTPUT]);
+        conf->input = asound_section_card (&sects[SECTION_INPUT]);
+        conf->bt_output = asound_section_bt_device (&sects[SECTION_OUTPUT]);
+        conf->bt_input = asound_section_bt_device (&sects[SECTION_INPUT]);
     }
-
-    /* is there a pcm.output section? update it if so; if not, append one */
-    if (!find_in_section (user_config_file, "pcm.output", "type"))
-        vsystem ("echo '" OUTPUT_A "' >> %s", num, user_config_file);
     else
-        vsystem ("sed -i '/pcm.output/,/}/c pcm.output {\\n\\ttype hw\\n\\tcard %d\\n}' %s", num, user_config_file);
+    {
+        /* default input device is same as output pcm device; if nothing valid found, default device is 0 */
+        conf->card = asound_section_card (&sects[SECTION_DEFAULT]);
+        if (conf->card == -1) conf->card = 0;
+        conf->input = conf->card == BLUEALSA_DEV ? 0 : conf->card;
+        conf->bt_output = asound_section_bt_device (&sects[SECTION_DEFAULT]);
+    }
 
-    /* is there a ctl.!default section? update it if so; if not, append one */
-    if (!find_in_section (user_config_file, "ctl.!default", "type"))
-        vsystem ("echo '" CTL_A "' >> %s", num, user_config_file);
-    else
-        vsystem ("sed -i '/ctl.!default/,/}/c ctl.!default {\\n\\ttype hw\\n\\tcard %d\\n}' %s", num, user_config_file);
+    for (i = 0; i < NUM_SECTIONS; i++) asound_free_section (&sects[i]);
+}
+
+static void asound_free_config (asound_config_t *conf)
+{
+    g_free (conf->bt_output);
+    g_free (conf->bt_input);
+    conf->bt_output = NULL;
+    conf->bt_input = NULL;
+}
+
+/* Get the current default device settings, rereading .asoundrc only if it has changed since last read */
+static asound_config_t *asound_get_config (VolumeALSAPlugin *vol)
+{
+    if (!vol->asoundrc_valid)
+    {
+        gint64 start = stat_start ();
+        DEBUG ("Reading .asoundrc");
+        asound_free_config (&vol->asoundrc);
+        asound_read_config (&vol->asoundrc);
+        vol->asoundrc_valid = TRUE;
+        stat_end (vol, "asound_read_config", start);
+    }
+    return &vol->asoundrc;
+}
+
+static void asound_invalidate_config (VolumeALSAPlugin *vol)
+{
+    vol->asoundrc_valid = FALSE;
+
+    /* the selected devices may have changed */
+    volumealsa_queue_device_menu (vol);
+}
+
+/* Handler for changes to .asoundrc made by this or any other process */
+static void asound_config_changed (GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent evt, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    asound_invalidate_config (vol);
+}
+
+static int asound_get_default_card (VolumeALSAPlugin *vol)
+{
+    return asound_get_config (vol)->card;
+}
+
+static int asound_get_default_input (VolumeALSAPlugin *vol)
+{
+    return asound_get_config (vol)->input;
+}
+
+/* Standard text blocks used in .asoundrc for ALSA (_A) and Bluetooth (_B) devices */
+#define PREFIX      "pcm.!default {\n\ttype asym\n\tplayback.pcm {\n\t\ttype plug\n\t\tslave.pcm \"output\"\n\t}\n\tcapture.pcm {\n\t\ttype plug\n\t\tslave.pcm \"input\"\n\t}\n}"
+#define OUTPUT_A    "pcm.output {\n\ttype hw\n\tcard %d\n}"
+#define INPUT_A     "pcm.input {\n\ttype hw\n\tcard %d\n}"
+#define CTL_A       "ctl.!default {\n\ttype hw\n\tcard %d\n}"
+#define OUTPUT_B    "pcm.output {\n\ttype bluealsa\n\tdevice \"%s\"\n\tprofile \"a2dp\"\n}"
+#define INPUT_B     "pcm.input {\n\ttype bluealsa\n\tdevice \"%s\"\n\tprofile \"sco\"\n}"
+#define CTL_B       "ctl.!default {\n\ttype bluealsa\n}"
+
+/* Convert a BlueZ object path into the Bluetooth address used in .asoundrc */
+static char *asound_bt_address (const char *devname)
+{
+    unsigned int b1, b2, b3, b4, b5, b6;
 
-    DONE: g_free (user_config_file);
+    if (!devname || sscanf (devname, "/org/bluez/hci0/dev_%x_%x_%x_%x_%x_%x", &b1, &b2, &b3, &b4, &b5, &b6) != 6) return NULL;
+    return g_strdup_printf ("%02X:%02X:%02X:%02X:%02X:%02X", b1, b2, b3, b4, b5, b6);
 }
 
-static void asound_set_default_input (int num)
+/* Write new contents for the pcm.output, pcm.input and ctl.!default sections of .asoundrc;
+ * a NULL block leaves that section as it is. All other sections in the file are preserved.
+ * The new file is built in memory and then replaced in a single write and rename, so
+ * that other processes never see a partly-updated file. */
+static void asound_write_config (VolumeALSAPlugin *vol, const char *output, const char *input, const char *ctl)
 {
     char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
-
-    /* does .asoundrc exist? if not, write default contents and exit */
-    if (!g_file_test (user_config_file, G_FILE_TEST_IS_REGULAR))
+    asound_config_t *conf = asound_get_config (vol);
+    gint64 start = stat_start ();
+    asound_section_t sects[NUM_SECTIONS];
+    asound_range_t *range;
+    char *blocks[NUM_SECTIONS], *text, *addr;
+    gboolean written[NUM_SECTIONS], asym;
+    GError *err = NULL;
+    GArray *ranges;
+    GString *res;
+    gsize pos = 0;
+    int i, card;
+
+    if (!g_file_get_contents (user_config_file, &text, NULL, NULL)) text = g_strdup ("");
+
+    memset (sects, 0, sizeof (sects));
+    ranges = g_array_new (FALSE, FALSE, sizeof (asound_range_t));
+    asound_parse_config (text, sects, ranges);
+    asym = !g_strcmp0 (sects[SECTION_DEFAULT].type, "asym");
+
+    blocks[SECTION_DEFAULT] = asym ? NULL : g_strdup (PREFIX);
+    blocks[SECTION_OUTPUT] = g_strdup (output);
+    blocks[SECTION_INPUT] = g_strdup (input);
+    blocks[SECTION_CTL] = g_strdup (ctl);
+
+    /* if the file does not use type asym, all the sections are replaced - any not supplied keep the current devices */
+    if (!asym)
     {
-        vsystem ("echo '" PREFIX "\n" OUTPUT_A "\n" INPUT_A "\n" CTL_A "' >> %s", 0, num, 0, user_config_file);
-        goto DONE;
+        addr = conf->card == BLUEALSA_DEV ? asound_bt_address (conf->bt_output) : NULL;
+        card = conf->card == BLUEALSA_DEV ? 0 : conf->card;
+        if (!blocks[SECTION_OUTPUT]) blocks[SECTION_OUTPUT] = addr ? g_strdup_printf (OUTPUT_B, addr) : g_strdup_printf (OUTPUT_A, card);
+        if (!blocks[SECTION_INPUT]) blocks[SECTION_INPUT] = g_strdup_printf (INPUT_A, conf->input);
+        if (!blocks[SECTION_CTL]) blocks[SECTION_CTL] = addr ? g_strdup (CTL_B) : g_strdup_printf (CTL_A, card);
+        g_free (addr);
     }
 
-    /* does .asoundrc use type asym? if not, replace file with default contents and current output, and exit */
-    if (!find_in_section (user_config_file, "pcm.!default", "asym"))
+    /* copy the existing file, replacing the first instance of each updated section and dropping any others */
+    res = g_string_new (NULL);
+    memset (written, 0, sizeof (written));
+    for (i = 0; i < ranges->len; i++)
     {
-        int dev = asound_get_default_card ();
-        if (dev != BLUEALSA_DEV)
-            vsystem ("echo '" PREFIX "\n" OUTPUT_A "\n" INPUT_A "\n" CTL_A "' > %s", dev, num, dev, user_config_file);
-        else
+        range = &g_array_index (ranges, asound_range_t, i);
+        g_string_append_len (res, text + pos, range->start - pos);
+        pos = range->end;
+
+        if (!blocks[range->sect]) g_string_append_len (res, text + range->start, range->end - range->start);
+        else if (asym && !written[range->sect])
         {
-            unsigned int b1, b2, b3, b4, b5, b6;
-            char *btdev = asound_get_bt_device ();
-            if (btdev && sscanf (btdev, "/org/bluez/hci0/dev_%x_%x_%x_%x_%x_%x", &b1, &b2, &b3, &b4, &b5, &b6) == 6)
-                vsystem ("echo '" PREFIX "\n" OUTPUT_B "\n" INPUT_A "\n" CTL_B "' > %s", b1, b2, b3, b4, b5, b6, num, user_config_file);
-            else
-                vsystem ("echo '" PREFIX "\n" OUTPUT_A "\n" INPUT_A "\n" CTL_A "' > %s", 0, num, 0, user_config_file);
-            if (btdev) g_free (btdev);
+            g_string_append (res, blocks[range->sect]);
+            written[range->sect] = TRUE;
         }
-        goto DONE;
+        else while (text[pos] && g_ascii_isspace (text[pos])) pos++;
     }
+    g_string_append (res, text + pos);
 
-    /* is there a pcm.input section? update it if so; if not, append one */
-    if (!find_in_section (user_config_file, "pcm.input", "type"))
-        vsystem ("echo '" INPUT_A "' >> %s", num, user_config_file);
-    else
-        vsystem ("sed -i '/pcm.input/,/}/c pcm.input {\\n\\ttype hw\\n\\tcard %d\\n}' %s", num, user_config_file);
+    /* append any updated sections which were not already in the file */
+    for (i = 0; i < NUM_SECTIONS; i++)
+    {
+        if (!blocks[i] || written[i]) continue;
+        while (res->len && g_ascii_isspace (res->str[res->len - 1])) g_string_truncate (res, res->len - 1);
+        if (res->len) g_string_append (res, "\n\n");
+        g_string_append_printf (res, "%s\n", blocks[i]);
+    }
 
-    DONE: g_free (user_config_file);
+    DEBUG ("Writing .asoundrc");
+    if (!g_file_set_contents (user_config_file, res->str, res->len, &err))
+    {
+        g_warning ("volumealsa: Cannot write %s - %s", user_config_file, err->message);
+        g_error_free (err);
+    }
+
+    for (i = 0; i < NUM_SECTIONS; i++)
+    {
+        asound_free_section (&sects[i]);
+        g_free (blocks[i]);
+    }
+    g_string_free (res, TRUE);
+    g_array_free (ranges, TRUE);
+    g_free (text);
+    g_free (user_config_file);
+    asound_invalidate_config (vol);
+    stat_end (vol, G_STRFUNC, start);
 }
 
-static char *asound_get_bt_device (void)
+static void asound_set_default_card (VolumeALSAPlugin *vol, int num)
 {
-    char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
-    char *res, *ret = NULL;
+    char *output = g_strdup_printf (OUTPUT_A, num);
+    char *ctl = g_strdup_printf (CTL_A, num);
 
-    /* first check the pcm.output section */
-    res = get_string ("sed -n '/pcm.output/,/}/{/device/p}' %s 2>/dev/null | cut -d '\"' -f 2 | tr : _", user_config_file);
-    if (strlen (res) == 17) goto DONE;
-    else g_free (res);
+    asound_write_config (vol, output, NULL, ctl);
+    g_free (output);
+    g_free (ctl);
+}
 
-    /* if nothing there, check the default block */
-    res = get_string ("sed -n '/pcm.!default/,/}/{/device/p}' %s 2>/dev/null | cut -d '\"' -f 2 | tr : _", user_config_file);
-    if (strlen (res) == 17) goto DONE;
-    else g_free (res);
+static void asound_set_default_input (VolumeALSAPlugin *vol, int num)
+{
+    char *input = g_strdup_printf (INPUT_A, num);
 
-    res = NULL;
-    DONE: g_free (user_config_file);
-    if (res)
-    {
-        ret = g_strdup_printf ("/org/bluez/hci0/dev_%s", res);
-        g_free (res);
-    }
-    return ret;
+    asound_write_config (vol, NULL, input, NULL);
+    g_free (input);
 }
 
-static char *asound_get_bt_input (void)
+static char *asound_get_bt_device (VolumeALSAPlugin *vol)
 {
-    char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
-    char *res, *ret = NULL;
-
-    /* check the pcm.input section */
-    res = get_string ("sed -n '/pcm.input/,/}/{/device/p}' %s 2>/dev/null | cut -d '\"' -f 2 | tr : _", user_config_file);
-    if (strlen (res) == 17) goto DONE;
-    else g_free (res);
+    return g_strdup (asound_get_config (vol)->bt_output);
+}
 
-    res = NULL;
-    DONE: g_free (user_config_file);
-    if (res)
-    {
-        ret = g_strdup_printf ("/org/bluez/hci0/dev_%s", res);
-        g_free (res);
-    }
-    return ret;
+static char *asound_get_bt_input (VolumeALSAPlugin *vol)
+{
+    return g_strdup (asound_get_config (vol)->bt_input);
 }
 
-static void asound_set_bt_device (const char *devname)
+static void asound_set_bt_device (VolumeALSAPlugin *vol, const char *devname)
 {
-    char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
-    unsigned int b1, b2, b3, b4, b5, b6;
+    char *addr, *output;
 
     /* parse the device name to make sure it is valid */
-    if (sscanf (devname, "/org/bluez/hci0/dev_%x_%x_%x_%x_%x_%x", &b1, &b2, &b3, &b4, &b5, &b6) != 6)
+    if (!(addr = asound_bt_address (devname)))
     {
         DEBUG ("Failed to set device - name %s invalid", devname);
-        goto DONE;
-    }
-
-    /* does .asoundrc exist? if not, write default contents and exit */
-    if (!g_file_test (user_config_file, G_FILE_TEST_IS_REGULAR))
-    {
-        vsystem ("echo '" PREFIX "\n" OUTPUT_B "\n" CTL_B "' >> %s", b1, b2, b3, b4, b5, b6, user_config_file);
-        goto DONE;
-    }
-
-    /* does .asoundrc use type asym? if not, replace file with default contents and exit */
-    if (!find_in_section (user_config_file, "pcm.!default", "asym"))
-    {
-        vsystem ("echo '" PREFIX "\n" OUTPUT_B "\n" CTL_B "' > %s", b1, b2, b3, b4, b5, b6, user_config_file);
-        goto DONE;
+        return;
     }
 
-    /* is there a pcm.output section? update it if so; if not, append one */
-    if (!find_in_section (user_config_file, "pcm.output", "type"))
-        vsystem ("echo '" OUTPUT_B "' >> %s", b1, b2, b3, b4, b5, b6, user_config_file);
-    else
-        vsystem ("sed -i '/pcm.output/,/}/c pcm.output {\\n\\ttype bluealsa\\n\\tdevice \"%02X:%02X:%02X:%02X:%02X:%02X\"\\n\\tprofile \"a2dp\"\\n}' %s", b1, b2, b3, b4, b5, b6, user_config_file);
-
-    /* is there a ctl.!default section? update it if so; if not, append one */
-    if (!find_in_section (user_config_file, "ctl.!default", "type"))
-        vsystem ("echo '" CTL_B "' >> %s", user_config_file);
-    else
-        vsystem ("sed -i '/ctl.!default/,/}/c ctl.!default {\\n\\ttype bluealsa\\n}' %s", user_config_file);
-
-    DONE: g_free (user_config_file);
+    output = g_strdup_printf (OUTPUT_B, addr);
+    asound_write_config (vol, output, NULL, CTL_B);
+    g_free (output);
+    g_free (addr);
 }
 
-static void asound_set_bt_input (const char *devname)
+static void asound_set_bt_input (VolumeALSAPlugin *vol, const char *devname)
 {
-    char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
-    unsigned int b1, b2, b3, b4, b5, b6;
+    char *addr, *input;
 
     /* parse the device name to make sure it is valid */
-    if (sscanf (devname, "/org/bluez/hci0/dev_%x_%x_%x_%x_%x_%x", &b1, &b2, &b3, &b4, &b5, &b6) != 6)
+    if (!(addr = asound_bt_address (devname)))
     {
         DEBUG ("Failed to set device - name %s invalid", devname);
-        goto DONE;
-    }
-
-    /* does .asoundrc exist? if not, write default contents and exit */
-    if (!g_file_test (user_config_file, G_FILE_TEST_IS_REGULAR))
-    {
-        vsystem ("echo '" PREFIX "\n" OUTPUT_A "\n" INPUT_B "\n" CTL_A "' >> %s", 0, b1, b2, b3, b4, b5, b6, 0, user_config_file);
-        goto DONE;
-    }
-
-    /* does .asoundrc use type asym? if not, replace file with default contents and current output, and exit */
-    if (!find_in_section (user_config_file, "pcm.!default", "asym"))
-    {
-        int dev = asound_get_default_card ();
-        if (dev != BLUEALSA_DEV)
-            vsystem ("echo '" PREFIX "\n" OUTPUT_A "\n" INPUT_B "\n" CTL_A "' > %s", dev, b1, b2, b3, b4, b5, b6, dev, user_config_file);
-        else
-        {
-            unsigned int c1, c2, c3, c4, c5, c6;
-            char *btdev = asound_get_bt_device ();
-            if (btdev && sscanf (btdev, "/org/bluez/hci0/dev_%x_%x_%x_%x_%x_%x", &c1, &c2, &c3, &c4, &c5, &c6) == 6)
-                vsystem ("echo '" PREFIX "\n" OUTPUT_B "\n" INPUT_B "\n" CTL_B "' > %s", c1, c2, c3, c4, c5, c6, b1, b2, b3, b4, b5, b6, user_config_file);
-            else
-                vsystem ("echo '" PREFIX "\n" OUTPUT_A "\n" INPUT_B "\n" CTL_A "' > %s", 0, b1, b2, b3, b4, b5, b6, 0, user_config_file);
-            if (btdev) g_free (btdev);
-        }
-        goto DONE;
+        return;
     }
 
-    /* is there a pcm.input section? update it if so; if not, append one */
-    if (!find_in_section (user_config_file, "pcm.input", "type"))
-        vsystem ("echo '" INPUT_B "' >> %s", b1, b2, b3, b4, b5, b6, user_config_file);
-    else
-        vsystem ("sed -i '/pcm.input/,/}/c pcm.input {\\n\\ttype bluealsa\\n\\tdevice \"%02X:%02X:%02X:%02X:%02X:%02X\"\\n\\tprofile \"sco\"\\n}' %s", b1, b2, b3, b4, b5, b6, user_config_file);
-
-    DONE: g_free (user_config_file);
+    input = g_strdup_printf (INPUT_B, addr);
+    asound_write_config (vol, NULL, input, NULL);
+    g_free (input);
+    g_free (addr);
 }
 
-static gboolean asound_is_current_bt_dev (const char *obj, gboolean is_input)
+static gboolean asound_is_current_bt_dev (VolumeALSAPlugin *vol, const char *obj, gboolean is_input)
 {
-    gboolean res = FALSE;
-    char *device = is_input ? asound_get_bt_input () : asound_get_bt_device ();
-    if (device)
-    {
-        if (strstr (obj, device)) res = TRUE;
-        g_free (device);
-    }
-    return res;
+    asound_config_t *conf = asound_get_config (vol);
+    const char *device = is_input ? conf->bt_input : conf->bt_output;
+
+    if (device && strstr (obj, device)) return TRUE;
+    return FALSE;
 }
 
-static int asound_get_bcm_device_num (void)
+static int asound_get_bcm_device_num (VolumeALSAPlugin *vol)
 {
-    int num = -1;
+    int i;
 
-    while (1)
-    {
-        if (snd_card_next (&num) < 0)
-        {
-            g_warning ("volumealsa: Cannot enumerate devices");
-            break;
-        }
-        if (num == -1) break;
+    for (i = 0; i < vol->cards->len; i++)
+        if (g_array_index (vol->cards, card_info_t, i).bcm) return g_array_index (vol->cards, card_info_t, i).num;
 
-        if (asound_is_bcm_device (num)) return num;
-    }
     return -1;
 }
 
-static int asound_is_bcm_device (int num)
+/* Returns 1 for the old single internal device, 2 for one of the new separate internal devices, 0 otherwise */
+static int asound_is_bcm_device (const char *name)
 {
-    char *name;
-    if (snd_card_get_name (num, &name)) return FALSE;
-    int res = strncmp (name, "bcm2835", 7);
-    if (!strncmp (name, "bcm2835", 7))
-    {
-        if (!g_strcmp0 (name, "bcm2835 ALSA")) res = 1;
-        else res = 2;
-    }
-    else res = 0;
-    g_free (name);
-
-    return res;
+    if (strncmp (name, "bcm2835", 7)) return 0;
+    if (!g_strcmp0 (name, "bcm2835 ALSA")) return 1;
+    return 2;
 }
 
-static char *asound_default_device_name (void)
+static char *asound_default_device_name (VolumeALSAPlugin *vol)
 {
-    int num = asound_get_default_card ();
+    int num = asound_get_default_card (vol);
     if (num == BLUEALSA_DEV) return g_strdup_printf ("bluealsa");
     else return g_strdup_printf ("hw:%d", num);
 }
 
-static char *asound_default_input_name (void)
+static char *asound_default_input_name (VolumeALSAPlugin *vol)
 {
-    int num = asound_get_default_input ();
+    int num = asound_get_default_input (vol);
     if (num == BLUEALSA_DEV) return g_strdup_printf ("bluealsa");
     else return g_strdup_printf ("hw:%d", num);
 }
@@ -1516,16 +2631,17 @@ static char *asound_default_input_name (void)
 /* Plugin handlers and graphics                                               */
 /*----------------------------------------------------------------------------*/
 
-/* Do a full redraw of the display. */
+/* Redraw the display - only those parts which have changed since the last redraw are updated. */
 static void volumealsa_update_display (VolumeALSAPlugin *vol)
 {
-    gboolean mute;
+    gboolean mute, has_mute, valid;
     int level;
 
-    if (vol->options_dlg) update_options (vol);
+    vol->display_dirty = FALSE;
 
     /* check that the mixer is still valid */
-    if (vol->master_element == NULL || snd_mixer_elem_get_type (vol->master_element) != SND_MIXER_ELEM_SIMPLE)
+    valid = vol->master_element != NULL;
+    if (!valid)
     {
         DEBUG ("Master element not valid");
         mute = TRUE;
@@ -1534,7 +2650,7 @@ static void volumealsa_update_display (VolumeALSAPlugin *vol)
     else
     {
         /* read current mute and volume status */
-        mute = asound_is_muted (vol);
+        mute = asound_is_muted (vol) || vol->fade_mute;
         level = asound_get_volume (vol);
         if (mute) level = 0;
     }
@@ -1547,33 +2663,99 @@ static void volumealsa_update_display (VolumeALSAPlugin *vol)
         else if (level >= 33) icon = "audio-volume-medium";
         else if (level > 0) icon = "audio-volume-low";
     }
-    lxpanel_plugin_set_taskbar_icon (vol->panel, vol->tray_icon, icon);
+    if (g_strcmp0 (icon, vol->disp_icon))
+    {
+        lxpanel_plugin_set_taskbar_icon (vol->panel, vol->tray_icon, icon);
+        vol->disp_icon = icon;
+    }
 
     /* update popup window controls */
     if (vol->mute_check)
     {
-        g_signal_handler_block (vol->mute_check, vol->mute_check_handler);
-        gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (vol->mute_check), mute);
-        gtk_widget_set_sensitive (vol->mute_check, asound_has_mute (vol) ? TRUE : FALSE);
-        g_signal_handler_unblock (vol->mute_check, vol->mute_check_handler);
+        has_mute = asound_has_mute (vol) ? TRUE : FALSE;
+        if (mute != vol->disp_mute || has_mute != vol->disp_has_mute)
+        {
+            g_signal_handler_block (vol->mute_check, vol->mute_check_handler);
+            gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (vol->mute_check), mute);
+            gtk_widget_set_sensitive (vol->mute_check, has_mute);
+            g_signal_handler_unblock (vol->mute_check, vol->mute_check_handler);
+            vol->disp_mute = mute;
+            vol->disp_has_mute = has_mute;
+        }
     }
 
     if (vol->volume_scale)
     {
-        g_signal_handler_block (vol->volume_scale, vol->volume_scale_handler);
-        gtk_range_set_value (GTK_RANGE (vol->volume_scale), level);
-        g_signal_handler_unblock (vol->volume_scale, vol->volume_scale_handler);
-        gtk_widget_set_sensitive (vol->volume_scale, (vol->master_element && snd_mixer_elem_get_type (vol->master_element) == SND_MIXER_ELEM_SIMPLE));
+        /* leave the scale alone if it is showing a level which has not been written yet */
+        if (level != vol->disp_level && vol->volume_pending < 0)
+        {
+            g_signal_handler_block (vol->volume_scale, vol->volume_scale_handler);
+            gtk_range_set_value (GTK_RANGE (vol->volume_scale), level);
+            g_signal_handler_unblock (vol->volume_scale, vol->volume_scale_handler);
+            vol->disp_level = level;
+        }
+        if (valid != vol->disp_valid)
+        {
+            gtk_widget_set_sensitive (vol->volume_scale, valid);
+            vol->disp_valid = valid;
+        }
     }
 
     /* update tooltip */
-    char *tooltip;
-    if (vol->master_element && snd_mixer_elem_get_type (vol->master_element) == SND_MIXER_ELEM_SIMPLE)
-        tooltip = g_strdup_printf ("%s %d", _("Volume control"), level);
+    if ((valid ? level : -2) != vol->disp_tooltip)
+    {
+        char *tooltip;
+        if (valid)
+            tooltip = g_strdup_printf ("%s %d", _("Volume control"), level);
+        else
+            tooltip = g_strdup_printf (_("No volume control on this device"));
+        gtk_widget_set_tooltip_text (vol->plugin, tooltip);
+        g_free (tooltip);
+        vol->disp_tooltip = valid ? level : -2;
+    }
+}
+
+/* Forget what is displayed, so that the next redraw updates everything */
+static void volumealsa_reset_display (VolumeALSAPlugin *vol)
+{
+    vol->disp_icon = NULL;
+    vol->disp_level = -1;
+    vol->disp_mute = -1;
+    vol->disp_has_mute = -1;
+    vol->disp_valid = -1;
+    vol->disp_tooltip = -1;
+}
+
+/* Redraw the display at the next frame - a burst of mixer events (an application ramping
+ * the volume, or a restore of the mixer settings) then only causes a single redraw. If the
+ * plugin is not mapped, its frame clock may not be running, so use an idle callback instead. */
+static void volumealsa_queue_update_display (VolumeALSAPlugin *vol)
+{
+    vol->display_dirty = TRUE;
+    if (vol->display_tick || vol->display_idle) return;
+
+    if (gtk_widget_get_mapped (vol->plugin))
+        vol->display_tick = gtk_widget_add_tick_callback (vol->plugin, volumealsa_update_display_tick, vol, NULL);
     else
-        tooltip = g_strdup_printf (_("No volume control on this device"));
-    gtk_widget_set_tooltip_text (vol->plugin, tooltip);
-    g_free (tooltip);
+        vol->display_idle = g_idle_add (volumealsa_update_display_idle, vol);
+}
+
+static gboolean volumealsa_update_display_tick (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+
+    vol->display_tick = 0;
+    if (vol->display_dirty) volumealsa_update_display (vol);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean volumealsa_update_display_idle (gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+
+    vol->display_idle = 0;
+    if (vol->display_dirty) volumealsa_update_display (vol);
+    return FALSE;
 }
 
 static void volumealsa_open_config_dialog (GtkWidget *widget, VolumeALSAPlugin *vol)
@@ -1609,6 +2791,7 @@ static void volumealsa_show_connect_dialog (VolumeALSAPlugin *vol, gboolean fail
         gtk_widget_hide (vol->conn_ok);
 
         gtk_widget_show (vol->conn_dialog);
+        volumealsa_queue_device_menu (vol);
     }
     else
     {
@@ -1626,6 +2809,7 @@ static void volumealsa_close_connect_dialog (GtkButton *button, gpointer user_da
     {
         gtk_widget_destroy (vol->conn_dialog);
         vol->conn_dialog = NULL;
+        volumealsa_queue_device_menu (vol);
     }
 }
 
@@ -1634,17 +2818,22 @@ static void volumealsa_close_connect_dialog (GtkButton *button, gpointer user_da
 static gboolean volumealsa_button_press_event (GtkWidget *widget, GdkEventButton *event, LXPanel *panel)
 {
     VolumeALSAPlugin *vol = lxpanel_plugin_get_data (widget);
+    gboolean res;
+    gint64 start;
 
     if (vol->stopped) return TRUE;
 
-    if (!asound_current_dev_check (vol)) volumealsa_update_display (vol);
+    start = stat_start ();
+    res = asound_current_dev_check (vol);
+    stat_end (vol, "asound_current_dev_check", start);
+    if (!res) volumealsa_update_display (vol);
 
 #if 0
-    if (vol->master_element == NULL && asound_get_default_card () == BLUEALSA_DEV && vol->objmanager)
+    if (vol->master_element == NULL && asound_get_default_card (vol) == BLUEALSA_DEV && vol->objmanager)
     {
         /* the mixer is unattached, and there is a default Bluetooth output device - try connecting it... */
         DEBUG ("No mixer with Bluetooth device - try to reconnect");
-        char *dev = asound_get_bt_device ();
+        char *dev = asound_get_bt_device (vol);
         if (dev)
         {
             if (!bt_is_connected (vol, dev))
@@ -1660,9 +2849,10 @@ static gboolean volumealsa_button_press_event (GtkWidget *widget, GdkEventButton
     if (event->button == 1)
     {
         /* left-click - show or hide volume popup */
-        if (!asound_has_volume_control (-1))
+        if (!(asound_default_caps (vol) & CAP_PLAYBACK_VOLUME))
         {
             GtkWidget *mi;
+            volumealsa_reset_device_menu (vol);
             vol->menu_popup = gtk_menu_new ();
             mi = gtk_menu_item_new_with_label (_("No volume control on this device"));
             gtk_widget_set_sensitive (mi, FALSE);
@@ -1679,19 +2869,26 @@ static gboolean volumealsa_button_press_event (GtkWidget *widget, GdkEventButton
         }
         else
         {
-            volumealsa_build_popup_window (vol->plugin);
+            GtkAllocation alloc;
+
+            if (!vol->popup_window) volumealsa_build_popup_window (vol->plugin);
             volumealsa_update_display (vol);
 
-            gint x, y;
-            gtk_window_set_position (GTK_WINDOW (vol->popup_window), GTK_WIN_POS_MOUSE);
-            // need to draw the window in order to allow the plugin position helper to get its size
-            gtk_widget_show_all (vol->popup_window);
-            gtk_widget_hide (vol->popup_window);
-            lxpanel_plugin_popup_set_position_helper (panel, widget, vol->popup_window, &x, &y);
-            gdk_window_move (gtk_widget_get_window (vol->popup_window), x, y);
+            /* the popup keeps its size until it is rebuilt, so its position only needs to be
+             * found again if it has been rebuilt or the plugin has moved on the panel */
+            gtk_widget_get_allocation (vol->plugin, &alloc);
+            if (!vol->popup_placed || alloc.x != vol->popup_anchor.x || alloc.y != vol->popup_anchor.y
+                || alloc.width != vol->popup_anchor.width || alloc.height != vol->popup_anchor.height)
+            {
+                // need to draw the window in order to allow the plugin position helper to get its size
+                gtk_widget_show (vol->popup_window);
+                gtk_widget_hide (vol->popup_window);
+                lxpanel_plugin_popup_set_position_helper (panel, widget, vol->popup_window, &vol->popup_x, &vol->popup_y);
+                vol->popup_anchor = alloc;
+                vol->popup_placed = TRUE;
+            }
+            gdk_window_move (gtk_widget_get_window (vol->popup_window), vol->popup_x, vol->popup_y);
             gtk_window_present (GTK_WINDOW (vol->popup_window));
-            g_signal_connect (G_OBJECT (vol->popup_window), "map-event", G_CALLBACK (volumealsa_popup_mapped), vol);
-            g_signal_connect (G_OBJECT (vol->popup_window), "button-press-event", G_CALLBACK (volumealsa_popup_button_press), vol);
             vol->show_popup = TRUE;
         }
     }
@@ -1702,9 +2899,8 @@ static gboolean volumealsa_button_press_event (GtkWidget *widget, GdkEventButton
     }
     else if (event->button == 3)
     {
-        /* right-click - show device list */
-        volumealsa_build_device_menu (vol);
-        gtk_widget_show_all (vol->menu_popup);
+        /* right-click - show device list, which is normally already up to date */
+        if (!vol->menu_devices[OUTPUT_MIXER] || vol->menu_dirty) volumealsa_update_device_menu (vol);
         gtk_menu_popup_at_widget (GTK_MENU (vol->menu_popup), vol->plugin, GDK_GRAVITY_NORTH_WEST, GDK_GRAVITY_NORTH_WEST, (GdkEvent *) event);
     }
     return TRUE;
@@ -1714,69 +2910,48 @@ static gboolean volumealsa_button_press_event (GtkWidget *widget, GdkEventButton
 /* Device select menu                                                         */
 /*----------------------------------------------------------------------------*/
 
-static GtkWidget *volumealsa_menu_item_add (VolumeALSAPlugin *vol, GtkWidget *menu, const char *label, const char *name, gboolean selected, gboolean input, GCallback cb)
+static void volumealsa_menu_entry_add (GPtrArray *entries, MixerIO menu, int section, const char *name, const char *label, gboolean selected, gboolean novol, GCallback cb)
 {
-    GList *list, *l;
-    int count;
-
-    GtkWidget *mi = gtk_check_menu_item_new_with_label (label);
-    gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (mi), selected);
-    if (selected)
-    {
-        if (input)
-        {
-            if (vol->idev_name) g_free (vol->idev_name);
-            vol->idev_name = g_strdup (label);
-        }
-        else
-        {
-            if (vol->odev_name) g_free (vol->odev_name);
-            vol->odev_name = g_strdup (label);
-        }
-    }
-    gtk_widget_set_name (mi, name);
-    g_signal_connect (mi, "activate", cb, (gpointer) vol);
-
-    // find the start point of the last section - either a separator or the beginning of the list
-    list = gtk_container_get_children (GTK_CONTAINER (menu));
-    count = g_list_length (list);
-    l = g_list_last (list);
-    while (l)
-    {
-        if (G_OBJECT_TYPE (l->data) == GTK_TYPE_SEPARATOR_MENU_ITEM) break;
-        count--;
-        l = l->prev;
-    }
-
-    // if l is NULL, init to element after start; if l is non-NULL, init to element after separator
-    if (!l) l = list;
-    else l = l->next;
+    menu_entry_t *entry = g_new0 (menu_entry_t, 1);
+
+    entry->menu = menu;
+    entry->section = section;
+    entry->name = g_strdup (name);
+    /* the routes on the internal card are numbered like cards, so they need keys of their own */
+    if (cb == G_CALLBACK (volumealsa_set_internal_output)) entry->key = g_strdup_printf ("route %s", name);
+    else entry->key = g_strdup (name);
+    entry->label = g_strdup (label);
+    entry->selected = selected;
+    entry->novol = novol;
+    entry->cb = cb;
+    g_ptr_array_add (entries, entry);
+}
 
-    // loop forward from the first element, comparing against the new label
-    while (l)
-    {
-        if (g_strcmp0 (label, gtk_menu_item_get_label (GTK_MENU_ITEM (l->data))) < 0) break;
-        count++;
-        l = l->next;
-    }
+static void volumealsa_menu_entry_free (gpointer data)
+{
+    menu_entry_t *entry = (menu_entry_t *) data;
 
-    gtk_menu_shell_insert (GTK_MENU_SHELL (menu), mi, count);
-    g_list_free (list);
-    return mi;
+    g_free (entry->key);
+    g_free (entry->name);
+    g_free (entry->label);
+    g_free (entry);
 }
 
-static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
+/* List the items the device menu should show, and the sections they fall into */
+static GPtrArray *volumealsa_device_menu_entries (VolumeALSAPlugin *vol, menu_layout_t *layout)
 {
-    GtkWidget *mi, *im = NULL, *om;
-    gint devices = 0, inputs = 0, card_num, def_card, def_inp;
-    gboolean ext_dev = FALSE, bt_dev = FALSE, osel = FALSE, isel = FALSE, ajack = TRUE;
+    GPtrArray *entries = g_ptr_array_new_with_free_func (volumealsa_menu_entry_free);
+    gint devices = 0, inputs = 0, card_num, def_card, def_inp, i;
+    card_info_t *card;
+    gboolean ext_dev = FALSE, bt_dev = FALSE, ajack = vol->analog;
 
-    def_card = asound_get_default_card ();
-    def_inp = asound_get_default_input ();
-    if (vsystem ("raspi-config nonint has_analog")) ajack = FALSE;
+    def_card = asound_get_default_card (vol);
+    def_inp = asound_get_default_input (vol);
 
-    vol->menu_popup = gtk_menu_new ();
-    // create input selector...
+    memset (layout, 0, sizeof (menu_layout_t));
+    layout->sections[OUTPUT_MIXER] = 1;
+
+    // list input devices...
     if (vol->objmanager)
     {
         // iterate all the objects the manager knows about
@@ -1800,10 +2975,9 @@ static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
                         GVariant *trusted = g_dbus_proxy_get_cached_property (G_DBUS_PROXY (interface), "Trusted");
                         if (name && icon && paired && trusted && g_variant_get_boolean (paired) && g_variant_get_boolean (trusted))
                         {
-                            // create a menu if there isn't one already
-                            if (!im) im = gtk_menu_new ();
-                            volumealsa_menu_item_add (vol, im, g_variant_get_string (name, NULL), objpath, asound_is_current_bt_dev (objpath, TRUE), TRUE, G_CALLBACK (volumealsa_set_bluetooth_input));
-                            if (asound_is_current_bt_dev (objpath, TRUE)) isel = TRUE;
+                            // Bluetooth inputs go in the first section of the input menu
+                            layout->sections[INPUT_MIXER] = 1;
+                            volumealsa_menu_entry_add (entries, INPUT_MIXER, 0, objpath, g_variant_get_string (name, NULL), asound_is_current_bt_dev (vol, objpath, TRUE), FALSE, G_CALLBACK (volumealsa_set_bluetooth_input));
                             inputs++;
                         }
                         g_variant_unref (name);
@@ -1819,63 +2993,30 @@ static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
         }
     }
 
-    card_num = -1;
-    while (1)
+    for (i = 0; i < vol->cards->len; i++)
     {
-        if (snd_card_next (&card_num) < 0)
-        {
-            g_warning ("volumealsa: Cannot enumerate devices");
-            break;
-        }
-        if (card_num == -1) break;
+        card = &g_array_index (vol->cards, card_info_t, i);
+        card_num = card->num;
 
-        if (asound_has_input (card_num))
+        if (card->caps & CAP_CAPTURE_VOLUME)
         {
-            char *nam, *dev;
-            snd_card_get_name (card_num, &nam);
-            dev = g_strdup_printf ("%d", card_num);
+            char *dev = g_strdup_printf ("%d", card_num);
 
-            // either create a menu, or add a separator if there already is one
-            if (!inputs) im = gtk_menu_new ();
-            else
-            {
-                mi = gtk_separator_menu_item_new ();
-                gtk_menu_shell_append (GTK_MENU_SHELL (im), mi);
-            }
-            volumealsa_menu_item_add (vol, im, nam, dev, card_num == def_inp, TRUE, G_CALLBACK (volumealsa_set_external_input));
-            if (card_num == def_inp) isel = TRUE;
+            // either start the input menu, or start a new section if there already is one
+            layout->sections[INPUT_MIXER] = inputs ? layout->sections[INPUT_MIXER] + 1 : 1;
+            volumealsa_menu_entry_add (entries, INPUT_MIXER, layout->sections[INPUT_MIXER] - 1, dev, card->name, card_num == def_inp, FALSE, G_CALLBACK (volumealsa_set_external_input));
             inputs++;
+            g_free (dev);
         }
     }
 
-    if (inputs)
-    {
-        // add the input options menu item to the input menu
-        mi = gtk_separator_menu_item_new ();
-        gtk_menu_shell_append (GTK_MENU_SHELL (im), mi);
-
-        mi = gtk_menu_item_new_with_label (_("Input Device Settings..."));
-        g_signal_connect (mi, "activate", G_CALLBACK (volumealsa_open_input_config_dialog), (gpointer) vol);
-        gtk_menu_shell_append (GTK_MENU_SHELL (im), mi);
-        gtk_widget_set_sensitive (mi, isel);
-    }
-
-    // create a submenu for the outputs if there is an input submenu
-    if (inputs) om = gtk_menu_new ();
-    else om = vol->menu_popup;
-
     /* add internal device... */
-    card_num = -1;
-    while (1)
+    for (i = 0; i < vol->cards->len; i++)
     {
-        if (snd_card_next (&card_num) < 0)
-        {
-            g_warning ("volumealsa: Cannot enumerate devices");
-            break;
-        }
-        if (card_num == -1) break;
+        card = &g_array_index (vol->cards, card_info_t, i);
+        card_num = card->num;
 
-        int res = asound_is_bcm_device (card_num);
+        int res = card->bcm;
 
         if (res == 1)
         {
@@ -1886,7 +3027,7 @@ static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
             if (card_num == def_card)
             {
                 /* read back the current input on the BCM device */
-                bcm = get_value ("amixer cget numid=3 2>/dev/null | grep : | cut -d = -f 2");
+                bcm = vol->route;
 
                 /* if auto, then set to HDMI if there is one, otherwise analog */
                 if (bcm == 0)
@@ -1899,19 +3040,19 @@ static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
             devices = 0;
             if (ajack)
             {
-                volumealsa_menu_item_add (vol, om, _("Analog"), "1", bcm == 1, FALSE, G_CALLBACK (volumealsa_set_internal_output));
+                volumealsa_menu_entry_add (entries, OUTPUT_MIXER, 0, "1", _("Analog"), bcm == 1, FALSE, G_CALLBACK (volumealsa_set_internal_output));
                 devices++;
             }
-            if (vol->hdmis == 1)
+            /* the old scheme only has routes for two HDMI devices */
+            if (vol->hdmis > 0)
             {
-                volumealsa_menu_item_add (vol, om, _("HDMI"), "2", bcm == 2, FALSE, G_CALLBACK (volumealsa_set_internal_output));
+                volumealsa_menu_entry_add (entries, OUTPUT_MIXER, 0, "2", hdmi_monitor_name (vol, 1), bcm == 2, FALSE, G_CALLBACK (volumealsa_set_internal_output));
                 devices++;
             }
-            else if (vol->hdmis == 2)
+            if (vol->hdmis > 1)
             {
-                volumealsa_menu_item_add (vol, om, vol->mon_names[0], "2", bcm == 2, FALSE, G_CALLBACK (volumealsa_set_internal_output));
-                volumealsa_menu_item_add (vol, om, vol->mon_names[1], "3", bcm == 3, FALSE, G_CALLBACK (volumealsa_set_internal_output));
-                devices += 2;
+                volumealsa_menu_entry_add (entries, OUTPUT_MIXER, 0, "3", hdmi_monitor_name (vol, 2), bcm == 3, FALSE, G_CALLBACK (volumealsa_set_internal_output));
+                devices++;
             }
             break;
         }
@@ -1919,18 +3060,15 @@ static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
         if (res == 2)
         {
             /* new scheme with separate devices for each internal input */
-            char *nam, *dev;
-            snd_card_get_name (card_num, &nam);
-            dev = g_strdup_printf ("%d", card_num);
-
-            if (!g_strcmp0 (nam, "bcm2835 HDMI 1"))
-                volumealsa_menu_item_add (vol, om, vol->hdmis == 1 ? _("HDMI") : vol->mon_names[0], dev, card_num == def_card, FALSE, G_CALLBACK (volumealsa_set_external_output));
-            else if (!g_strcmp0 (nam, "bcm2835 HDMI 2"))
-                volumealsa_menu_item_add (vol, om, vol->hdmis == 1 ? _("HDMI") : vol->mon_names[1], dev, card_num == def_card, FALSE, G_CALLBACK (volumealsa_set_external_output));
+            const char *nam = card->name;
+            char *dev = g_strdup_printf ("%d", card_num);
+            int hdmi;
+
+            if (sscanf (nam, "bcm2835 HDMI %d", &hdmi) == 1)
+                volumealsa_menu_entry_add (entries, OUTPUT_MIXER, 0, dev, hdmi_monitor_name (vol, hdmi), card_num == def_card, FALSE, G_CALLBACK (volumealsa_set_external_output));
             else if (ajack)
-                volumealsa_menu_item_add (vol, om, _("Analog"), dev, card_num == def_card, FALSE, G_CALLBACK (volumealsa_set_external_output));
+                volumealsa_menu_entry_add (entries, OUTPUT_MIXER, 0, dev, _("Analog"), card_num == def_card, FALSE, G_CALLBACK (volumealsa_set_external_output));
 
-            g_free (nam);
             g_free (dev);
             devices++;
         }
@@ -1960,14 +3098,9 @@ static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
                         GVariant *trusted = g_dbus_proxy_get_cached_property (G_DBUS_PROXY (interface), "Trusted");
                         if (name && icon && paired && trusted && g_variant_get_boolean (paired) && g_variant_get_boolean (trusted))
                         {
-                            if (!bt_dev && devices)
-                            {
-                                mi = gtk_separator_menu_item_new ();
-                                gtk_menu_shell_append (GTK_MENU_SHELL (om), mi);
-                            }
-
-                            volumealsa_menu_item_add (vol, om, g_variant_get_string (name, NULL), objpath, asound_is_current_bt_dev (objpath, FALSE), FALSE, G_CALLBACK (volumealsa_set_bluetooth_output));
-                            if (asound_is_current_bt_dev (objpath, FALSE)) osel = TRUE;
+                            if (!bt_dev && devices) layout->sections[OUTPUT_MIXER]++;
+
+                            volumealsa_menu_entry_add (entries, OUTPUT_MIXER, layout->sections[OUTPUT_MIXER] - 1, objpath, g_variant_get_string (name, NULL), asound_is_current_bt_dev (vol, objpath, FALSE), FALSE, G_CALLBACK (volumealsa_set_bluetooth_output));
                             bt_dev = TRUE;
                             devices++;
                         }
@@ -1985,58 +3118,146 @@ static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
     }
 
     // add external devices...
-    card_num = -1;
-    while (1)
+    for (i = 0; i < vol->cards->len; i++)
     {
-        if (snd_card_next (&card_num) < 0)
-        {
-            g_warning ("volumealsa: Cannot enumerate devices");
-            break;
-        }
-        if (card_num == -1) break;
+        card = &g_array_index (vol->cards, card_info_t, i);
+        card_num = card->num;
 
-        if (!asound_is_bcm_device (card_num))
+        if (!card->bcm)
         {
-            char *nam, *dev;
-            snd_card_get_name (card_num, &nam);
-            dev = g_strdup_printf ("%d", card_num);
+            char *dev = g_strdup_printf ("%d", card_num);
 
-            if (!ext_dev && devices)
-            {
-                mi = gtk_separator_menu_item_new ();
-                gtk_menu_shell_append (GTK_MENU_SHELL (om), mi);
-            }
+            if (!ext_dev && devices) layout->sections[OUTPUT_MIXER]++;
 
-            mi = volumealsa_menu_item_add (vol, om, nam, dev, card_num == def_card, FALSE, G_CALLBACK (volumealsa_set_external_output));
-            if (card_num == def_card) osel = TRUE;
-            if (!asound_has_volume_control (card_num))
-            {
-                char *lab = g_strdup_printf ("<i>%s</i>", nam);
-                gtk_label_set_markup (GTK_LABEL (gtk_bin_get_child (GTK_BIN (mi))), lab);
-                gtk_widget_set_tooltip_text (mi, _("No volume control on this device"));
-                g_free (lab);
-            }
+            volumealsa_menu_entry_add (entries, OUTPUT_MIXER, layout->sections[OUTPUT_MIXER] - 1, dev, card->name, card_num == def_card, !(card->caps & CAP_PLAYBACK_VOLUME), G_CALLBACK (volumealsa_set_external_output));
 
-            g_free (nam);
             g_free (dev);
             ext_dev = TRUE;
             devices++;
         }
     }
 
-    if (bt_dev || ext_dev)
+    layout->settings = bt_dev || ext_dev;
+    layout->devices = devices ? TRUE : FALSE;
+    return entries;
+}
+
+/* Give a menu the given number of sorted sections, separated by separators. The sections are
+ * kept with the menu; any items not placed by volumealsa_menu_section_insert come after them. */
+static void volumealsa_menu_sections_add (GtkWidget *menu, int sections)
+{
+    GPtrArray *sects = g_ptr_array_new_with_free_func ((GDestroyNotify) g_ptr_array_unref);
+    int s;
+
+    for (s = 0; s < sections; s++)
+    {
+        if (s) gtk_menu_shell_append (GTK_MENU_SHELL (menu), gtk_separator_menu_item_new ());
+        g_ptr_array_add (sects, g_ptr_array_new ());
+    }
+    g_object_set_data_full (G_OBJECT (menu), "sections", sects, (GDestroyNotify) g_ptr_array_unref);
+}
+
+/* Place an item in a section of a menu, after any items with the same or a lower label */
+static void volumealsa_menu_section_insert (GtkWidget *menu, GtkWidget *mi, int section)
+{
+    GPtrArray *sects = (GPtrArray *) g_object_get_data (G_OBJECT (menu), "sections");
+    GPtrArray *items = (GPtrArray *) g_ptr_array_index (sects, section);
+    const char *label = (const char *) g_object_get_data (G_OBJECT (mi), "label");
+    int pos = 0, s, lo, hi, mid;
+
+    // each earlier section is followed by a separator
+    for (s = 0; s < section; s++) pos += ((GPtrArray *) g_ptr_array_index (sects, s))->len + 1;
+
+    lo = 0;
+    hi = items->len;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (g_strcmp0 (label, g_object_get_data (G_OBJECT (g_ptr_array_index (items, mid)), "label")) < 0) hi = mid;
+        else lo = mid + 1;
+    }
+
+    g_ptr_array_insert (items, lo, mi);
+    g_object_set_data (G_OBJECT (mi), "section", GINT_TO_POINTER (section));
+    if (gtk_widget_get_parent (mi)) gtk_menu_reorder_child (GTK_MENU (menu), mi, pos + lo);
+    else gtk_menu_shell_insert (GTK_MENU_SHELL (menu), mi, pos + lo);
+}
+
+/* Take an item out of its section - it stays in the menu until it is destroyed or placed again */
+static void volumealsa_menu_section_remove (GtkWidget *menu, GtkWidget *mi)
+{
+    GPtrArray *sects = (GPtrArray *) g_object_get_data (G_OBJECT (menu), "sections");
+    int section = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (mi), "section"));
+
+    g_ptr_array_remove (g_ptr_array_index (sects, section), mi);
+}
+
+static void volumealsa_menu_item_set_label (GtkWidget *mi, const char *label, gboolean novol)
+{
+    GtkLabel *lbl;
+
+    g_object_set_data_full (G_OBJECT (mi), "label", g_strdup (label), g_free);
+    g_object_set_data (G_OBJECT (mi), "novol", GINT_TO_POINTER (novol));
+    gtk_menu_item_set_label (GTK_MENU_ITEM (mi), label);
+    lbl = GTK_LABEL (gtk_bin_get_child (GTK_BIN (mi)));
+    if (novol)
+    {
+        char *lab = g_strdup_printf ("<i>%s</i>", label);
+        gtk_label_set_markup (lbl, lab);
+        gtk_widget_set_tooltip_text (mi, _("No volume control on this device"));
+        g_free (lab);
+    }
+    else
+    {
+        gtk_label_set_text (lbl, label);
+        gtk_widget_set_tooltip_text (mi, NULL);
+    }
+}
+
+/* Create the device menu with empty sections, and the items which do not depend on the devices */
+static void volumealsa_build_device_menu (VolumeALSAPlugin *vol, const menu_layout_t *layout)
+{
+    GtkWidget *mi, *im = NULL, *om;
+    int io;
+    gint64 start = stat_start ();
+
+    volumealsa_reset_device_menu (vol);
+    for (io = OUTPUT_MIXER; io <= INPUT_MIXER; io++)
+        if (!vol->menu_items[io]) vol->menu_items[io] = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    vol->menu_layout = *layout;
+    vol->menu_popup = gtk_menu_new ();
+
+    if (layout->sections[INPUT_MIXER])
+    {
+        im = gtk_menu_new ();
+        volumealsa_menu_sections_add (im, layout->sections[INPUT_MIXER]);
+
+        // add the input options menu item to the input menu
+        gtk_menu_shell_append (GTK_MENU_SHELL (im), gtk_separator_menu_item_new ());
+
+        mi = gtk_menu_item_new_with_label (_("Input Device Settings..."));
+        g_signal_connect (mi, "activate", G_CALLBACK (volumealsa_open_input_config_dialog), (gpointer) vol);
+        gtk_menu_shell_append (GTK_MENU_SHELL (im), mi);
+        vol->menu_settings[INPUT_MIXER] = mi;
+    }
+
+    // create a submenu for the outputs if there is an input submenu
+    if (im) om = gtk_menu_new ();
+    else om = vol->menu_popup;
+    volumealsa_menu_sections_add (om, layout->sections[OUTPUT_MIXER]);
+
+    if (layout->settings)
     {
         // add the output options menu item to the output menu
-        mi = gtk_separator_menu_item_new ();
-        gtk_menu_shell_append (GTK_MENU_SHELL (om), mi);
+        gtk_menu_shell_append (GTK_MENU_SHELL (om), gtk_separator_menu_item_new ());
 
         mi = gtk_menu_item_new_with_label (_("Output Device Settings..."));
         g_signal_connect (mi, "activate", G_CALLBACK (volumealsa_open_config_dialog), (gpointer) vol);
         gtk_menu_shell_append (GTK_MENU_SHELL (om), mi);
-        gtk_widget_set_sensitive (mi, osel);
+        vol->menu_settings[OUTPUT_MIXER] = mi;
     }
 
-    if (inputs)
+    if (im)
     {
         // insert submenus
         mi = gtk_menu_item_new_with_label (_("Audio Outputs"));
@@ -2051,84 +3272,238 @@ static void volumealsa_build_device_menu (VolumeALSAPlugin *vol)
         gtk_menu_shell_append (GTK_MENU_SHELL (vol->menu_popup), mi);
     }
 
-    if (!devices)
+    if (!layout->devices)
     {
         mi = gtk_menu_item_new_with_label (_("No audio devices found"));
         gtk_widget_set_sensitive (GTK_WIDGET (mi), FALSE);
         gtk_menu_shell_append (GTK_MENU_SHELL (vol->menu_popup), mi);
     }
 
+    vol->menu_devices[OUTPUT_MIXER] = om;
+    vol->menu_devices[INPUT_MIXER] = im;
+    gtk_widget_show_all (vol->menu_popup);
+    stat_end (vol, G_STRFUNC, start);
+}
+
+/* Throw away the device menu, so that it is built again when next updated */
+static void volumealsa_reset_device_menu (VolumeALSAPlugin *vol)
+{
+    int io;
+
+    if (vol->menu_popup) gtk_widget_destroy (vol->menu_popup);
+    vol->menu_popup = NULL;
+    for (io = OUTPUT_MIXER; io <= INPUT_MIXER; io++)
+    {
+        if (vol->menu_items[io]) g_hash_table_remove_all (vol->menu_items[io]);
+        vol->menu_devices[io] = NULL;
+        vol->menu_settings[io] = NULL;
+    }
+    vol->menu_dirty = TRUE;
+}
+
+/* Bring the device menu up to date - the items for each device are kept, and only those which
+ * have changed are added, removed, relabelled or checked. The menu is only built again if
+ * its sections have changed. */
+static void volumealsa_update_device_menu (VolumeALSAPlugin *vol)
+{
+    GPtrArray *entries;
+    GHashTable *keep;
+    GHashTableIter iter;
+    GList *items, *head;
+    GtkWidget *mi, *menu;
+    menu_entry_t *entry;
+    menu_layout_t layout;
+    gpointer key;
+    gboolean sel[2] = { FALSE, FALSE }, locked;
+    int io, i;
+    gint64 start = stat_start ();
+
+    entries = volumealsa_device_menu_entries (vol, &layout);
+    if (!vol->menu_devices[OUTPUT_MIXER] || memcmp (&layout, &vol->menu_layout, sizeof (menu_layout_t)))
+        volumealsa_build_device_menu (vol, &layout);
+    vol->menu_dirty = FALSE;
+
+    // remove the items for devices which have gone
+    for (io = OUTPUT_MIXER; io <= INPUT_MIXER; io++)
+    {
+        keep = g_hash_table_new (g_str_hash, g_str_equal);
+        for (i = 0; i < entries->len; i++)
+        {
+            entry = (menu_entry_t *) g_ptr_array_index (entries, i);
+            if (entry->menu == io) g_hash_table_add (keep, entry->key);
+        }
+
+        g_hash_table_iter_init (&iter, vol->menu_items[io]);
+        while (g_hash_table_iter_next (&iter, &key, (gpointer *) &mi))
+        {
+            if (g_hash_table_contains (keep, key)) continue;
+            volumealsa_menu_section_remove (vol->menu_devices[io], mi);
+            gtk_widget_destroy (mi);
+            g_hash_table_iter_remove (&iter);
+        }
+        g_hash_table_destroy (keep);
+    }
+
+    // add the items for new devices, and change any others which differ
+    for (i = 0; i < entries->len; i++)
+    {
+        entry = (menu_entry_t *) g_ptr_array_index (entries, i);
+        menu = vol->menu_devices[entry->menu];
+        mi = (GtkWidget *) g_hash_table_lookup (vol->menu_items[entry->menu], entry->key);
+        if (!mi)
+        {
+            mi = gtk_check_menu_item_new ();
+            gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (mi), entry->selected);
+            gtk_widget_set_name (mi, entry->name);
+            g_signal_connect (mi, "activate", entry->cb, (gpointer) vol);
+            volumealsa_menu_item_set_label (mi, entry->label, entry->novol);
+            volumealsa_menu_section_insert (menu, mi, entry->section);
+            gtk_widget_show (mi);
+            g_hash_table_insert (vol->menu_items[entry->menu], g_strdup (entry->key), mi);
+        }
+        else
+        {
+            if (entry->section != GPOINTER_TO_INT (g_object_get_data (G_OBJECT (mi), "section"))
+                || g_strcmp0 (entry->label, g_object_get_data (G_OBJECT (mi), "label")))
+            {
+                volumealsa_menu_section_remove (menu, mi);
+                volumealsa_menu_item_set_label (mi, entry->label, entry->novol);
+                volumealsa_menu_section_insert (menu, mi, entry->section);
+            }
+            else if (entry->novol != GPOINTER_TO_INT (g_object_get_data (G_OBJECT (mi), "novol")))
+                volumealsa_menu_item_set_label (mi, entry->label, entry->novol);
+
+            // setting the check mark activates the item, so keep the handler out of it
+            if (gtk_check_menu_item_get_active (GTK_CHECK_MENU_ITEM (mi)) != entry->selected)
+            {
+                g_signal_handlers_block_by_func (mi, entry->cb, vol);
+                gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (mi), entry->selected);
+                g_signal_handlers_unblock_by_func (mi, entry->cb, vol);
+            }
+        }
+
+        if (entry->selected)
+        {
+            sel[entry->menu] = TRUE;
+            if (entry->menu == INPUT_MIXER)
+            {
+                if (vol->idev_name) g_free (vol->idev_name);
+                vol->idev_name = g_strdup (entry->label);
+            }
+            else
+            {
+                if (vol->odev_name) g_free (vol->odev_name);
+                vol->odev_name = g_strdup (entry->label);
+            }
+        }
+    }
+
+    // the settings items need a device to be selected
+    for (io = OUTPUT_MIXER; io <= INPUT_MIXER; io++)
+        if (vol->menu_settings[io]) gtk_widget_set_sensitive (vol->menu_settings[io], sel[io]);
+
     // lock menu if a dialog is open
-    if (vol->conn_dialog || vol->options_dlg)
+    locked = vol->conn_dialog || vol->options_dlg;
+    items = gtk_container_get_children (GTK_CONTAINER (vol->menu_popup));
+    head = items;
+    while (items)
     {
-        GList *items = gtk_container_get_children (GTK_CONTAINER (vol->menu_popup));
-        GList *head = items;
-        while (items)
-        {
-            gtk_widget_set_sensitive (GTK_WIDGET (items->data), FALSE);
-            items = items->next;
-        }
-        g_list_free (head);
+        mi = GTK_WIDGET (items->data);
+        if (mi == vol->menu_settings[OUTPUT_MIXER]) gtk_widget_set_sensitive (mi, !locked && sel[OUTPUT_MIXER]);
+        else if (GTK_IS_CHECK_MENU_ITEM (mi) || gtk_menu_item_get_submenu (GTK_MENU_ITEM (mi)))
+            gtk_widget_set_sensitive (mi, !locked);
+        items = items->next;
     }
+    g_list_free (head);
+
+    g_ptr_array_free (entries, TRUE);
+    stat_end (vol, G_STRFUNC, start);
+}
+
+/* The device menu is kept between uses, and brought up to date when idle after anything it
+ * shows has changed - cards, monitors, Bluetooth devices, the default devices or the open
+ * dialogs - so that showing it does not need to query the devices. An update is deferred
+ * while the menu is on screen, and then done when it is next shown. */
+
+static void volumealsa_queue_device_menu (VolumeALSAPlugin *vol)
+{
+    vol->menu_dirty = TRUE;
+    if (!vol->menu_idle) vol->menu_idle = g_idle_add (volumealsa_device_menu_idle, vol);
+}
+
+static gboolean volumealsa_device_menu_idle (gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+
+    vol->menu_idle = 0;
+    if (vol->menu_dirty && !(vol->menu_popup && gtk_widget_get_mapped (vol->menu_popup)))
+        volumealsa_update_device_menu (vol);
+    return FALSE;
 }
 
 static void volumealsa_set_external_output (GtkWidget *widget, VolumeALSAPlugin *vol)
 {
+    gint64 start = stat_start ();
     int dev;
 
     if (sscanf (gtk_widget_get_name (widget), "%d", &dev) == 1)
     {
         /* if there is a Bluetooth device in use, get its name so we can disconnect it */
-        char *device = asound_get_bt_device ();
+        char *device = asound_get_bt_device (vol);
 
-        asound_set_default_card (dev);
+        asound_set_default_card (vol, dev);
         asound_initialize (vol);
         volumealsa_update_display (vol);
 
         /* disconnect old Bluetooth device if it is not also input */
         if (device)
         {
-            char *dev2 = asound_get_bt_input ();
+            char *dev2 = asound_get_bt_input (vol);
             if (g_strcmp0 (device, dev2)) bt_disconnect_device (vol, device);
             if (dev2) g_free (dev2);
             g_free (device);
         }
     }
+    stat_end (vol, G_STRFUNC, start);
 }
 
 static void volumealsa_set_external_input (GtkWidget *widget, VolumeALSAPlugin *vol)
 {
+    gint64 start = stat_start ();
     int dev;
 
     if (sscanf (gtk_widget_get_name (widget), "%d", &dev) == 1)
     {
         /* if there is a Bluetooth device in use, get its name so we can disconnect it */
-        char *device = asound_get_bt_input ();
+        char *device = asound_get_bt_input (vol);
 
-        asound_set_default_input (dev);
+        asound_set_default_input (vol, dev);
 
         /* disconnect old Bluetooth device if it is not also output */
         if (device)
         {
-            char *dev2 = asound_get_bt_device ();
+            char *dev2 = asound_get_bt_device (vol);
             if (g_strcmp0 (device, dev2)) bt_disconnect_device (vol, device);
             if (dev2) g_free (dev2);
             g_free (device);
         }
     }
+    stat_end (vol, G_STRFUNC, start);
 }
 
 static void volumealsa_set_internal_output (GtkWidget *widget, VolumeALSAPlugin *vol)
 {
+    gint64 start = stat_start ();
+
     /* if there is a Bluetooth device in use, get its name so we can disconnect it */
-    char *device = asound_get_bt_device ();
+    char *device = asound_get_bt_device (vol);
 
     /* check that the BCM device is default... */
-    int dev = asound_get_bcm_device_num ();
-    if (dev != asound_get_default_card ()) asound_set_default_card (dev);
+    int dev = asound_get_bcm_device_num (vol);
+    if (dev != asound_get_default_card (vol)) asound_set_default_card (vol, dev);
 
     /* set the output channel on the BCM device */
-    vsystem ("amixer -q cset numid=3 %s 2>/dev/null", gtk_widget_get_name (widget));
+    asound_route_write (vol, atoi (gtk_widget_get_name (widget)));
 
     asound_initialize (vol);
     volumealsa_update_display (vol);
@@ -2136,11 +3511,12 @@ static void volumealsa_set_internal_output (GtkWidget *widget, VolumeALSAPlugin
     /* disconnect old Bluetooth device if it is not also input */
     if (device)
     {
-        char *dev2 = asound_get_bt_input ();
+        char *dev2 = asound_get_bt_input (vol);
         if (g_strcmp0 (device, dev2)) bt_disconnect_device (vol, device);
         if (dev2) g_free (dev2);
         g_free (device);
     }
+    stat_end (vol, G_STRFUNC, start);
 }
 
 static void volumealsa_set_bluetooth_output (GtkWidget *widget, VolumeALSAPlugin *vol)
@@ -2148,7 +3524,7 @@ static void volumealsa_set_bluetooth_output (GtkWidget *widget, VolumeALSAPlugin
     asound_deinitialize (vol);
     volumealsa_update_display (vol);
 
-    char *odevice = asound_get_bt_device ();
+    char *odevice = asound_get_bt_device (vol);
 
     // is this device already connected and attached - might want to force reconnect here?
     if (!g_strcmp0 (gtk_widget_get_name (widget), odevice))
@@ -2169,13 +3545,13 @@ static void volumealsa_set_bluetooth_output (GtkWidget *widget, VolumeALSAPlugin
         return;
     }
 
-    char *idevice = asound_get_bt_input ();
+    char *idevice = asound_get_bt_input (vol);
 
     // check to see if this device is already connected
     if (!g_strcmp0 (gtk_widget_get_name (widget), idevice))
     {
         DEBUG ("Device %s is already connected", gtk_widget_get_name (widget));
-        asound_set_bt_device (gtk_widget_get_name (widget));
+        asound_set_bt_device (vol, gtk_widget_get_name (widget));
         asound_initialize (vol);
         volumealsa_update_display (vol);
 
@@ -2204,7 +3580,7 @@ static void volumealsa_set_bluetooth_output (GtkWidget *widget, VolumeALSAPlugin
 
 static void volumealsa_set_bluetooth_input (GtkWidget *widget, VolumeALSAPlugin *vol)
 {
-    char *idevice = asound_get_bt_input ();
+    char *idevice = asound_get_bt_input (vol);
 
     // is this device already connected and attached - might want to force reconnect here?
     if (!g_strcmp0 (gtk_widget_get_name (widget), idevice))
@@ -2225,13 +3601,13 @@ static void volumealsa_set_bluetooth_input (GtkWidget *widget, VolumeALSAPlugin
         return;
     }
 
-    char *odevice = asound_get_bt_device ();
+    char *odevice = asound_get_bt_device (vol);
 
     // check to see if this device is already connected
     if (!g_strcmp0 (gtk_widget_get_name (widget), odevice))
     {
         DEBUG ("Device %s is already connected\n", gtk_widget_get_name (widget));
-        asound_set_bt_input (gtk_widget_get_name (widget));
+        asound_set_bt_input (vol, gtk_widget_get_name (widget));
 
         /* disconnect old Bluetooth input device */
         if (idevice) bt_disconnect_device (vol, idevice);
@@ -2266,8 +3642,20 @@ static void volumealsa_build_popup_window (GtkWidget *p)
 {
     VolumeALSAPlugin *vol = lxpanel_plugin_get_data (p);
 
+    /* Write any pending volume before the scale it is queued on is destroyed */
+    if (vol->volume_tick)
+    {
+        gtk_widget_remove_tick_callback (vol->volume_scale, vol->volume_tick);
+        vol->volume_tick = 0;
+        volumealsa_write_volume (vol);
+    }
+
     if (vol->popup_window) gtk_widget_destroy (vol->popup_window);
 
+    /* New controls and possibly a new icon size, so everything needs to be redrawn and the popup repositioned */
+    volumealsa_reset_display (vol);
+    vol->popup_placed = FALSE;
+
     /* Create a new window. */
     vol->popup_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
     gtk_widget_set_name (vol->popup_window, "panelpopup");
@@ -2316,17 +3704,32 @@ static void volumealsa_build_popup_window (GtkWidget *p)
     gtk_box_pack_end (GTK_BOX (box), vol->mute_check, FALSE, FALSE, 0);
     vol->mute_check_handler = g_signal_connect (vol->mute_check, "toggled", G_CALLBACK (volumealsa_popup_mute_toggled), vol);
     gtk_widget_set_can_focus (vol->mute_check, FALSE);
+
+    /* The window is kept and reused until the panel configuration changes, so its contents
+     * are shown now and its signals are connected only once. */
+    gtk_widget_show_all (box);
+    gtk_window_set_position (GTK_WINDOW (vol->popup_window), GTK_WIN_POS_MOUSE);
+    g_signal_connect (G_OBJECT (vol->popup_window), "map-event", G_CALLBACK (volumealsa_popup_mapped), vol);
+    g_signal_connect (G_OBJECT (vol->popup_window), "button-press-event", G_CALLBACK (volumealsa_popup_button_press), vol);
 }
 
 /* Handler for "value_changed" signal on popup window vertical scale. */
 static void volumealsa_popup_scale_changed (GtkRange *range, VolumeALSAPlugin *vol)
 {
-    /* Reflect the value of the control to the sound system. */
+    /* Reflect the value of the control to the sound system - dragging the slider or scrolling
+     * generates far more changes than need to be written, so only the latest is kept and written
+     * at most once per frame. */
     if (!asound_is_muted (vol))
-        asound_set_volume (vol, gtk_range_get_value (range));
-
-    /* Redraw the controls. */
-    volumealsa_update_display (vol);
+    {
+        vol->volume_pending = gtk_range_get_value (range);
+        volumealsa_queue_volume_write (vol);
+    }
+    else
+    {
+        /* nothing is written while muted, so put the slider back to the level shown */
+        vol->disp_level = -1;
+        volumealsa_queue_update_display (vol);
+    }
 }
 
 /* Handler for "scroll-event" signal on popup window vertical scale. */
@@ -2351,11 +3754,65 @@ static void volumealsa_popup_scale_scrolled (GtkScale *scale, GdkEventScroll *ev
     gtk_range_set_value (GTK_RANGE (vol->volume_scale), CLAMP((int) val, 0, 100));
 }
 
+/* Schedule a write of the pending volume, unless one is already scheduled */
+static void volumealsa_queue_volume_write (VolumeALSAPlugin *vol)
+{
+    if (vol->volume_tick || vol->volume_timer) return;
+
+    if (vol->volume_interval == 0 && gtk_widget_get_mapped (vol->volume_scale))
+        vol->volume_tick = gtk_widget_add_tick_callback (vol->volume_scale, volumealsa_write_volume_tick, vol, NULL);
+    else
+        vol->volume_timer = g_timeout_add (vol->volume_interval ? vol->volume_interval : VOLUME_WRITE_INTERVAL,
+            volumealsa_write_volume_timer, vol);
+}
+
+/* Write the pending volume to the hardware */
+static void volumealsa_write_volume (VolumeALSAPlugin *vol)
+{
+    int volume = vol->volume_pending;
+    int old;
+
+    if (volume < 0) return;
+    vol->volume_pending = -1;
+
+    asound_fade_cancel (vol);
+    old = asound_get_volume (vol);
+    asound_set_volume (vol, volume);
+
+    /* the mixer event caused by this write need not redraw the display again - but a write
+     * which does not change the hardware causes no event, so there is nothing to expect */
+    volume = asound_get_volume (vol);
+    vol->volume_echo = volume != old ? volume : -1;
+    vol->volume_echo_mute = asound_is_muted (vol);
+
+    /* Redraw the controls - the scale may no longer show the level last set on it. */
+    vol->disp_level = -1;
+    volumealsa_update_display (vol);
+}
+
+static gboolean volumealsa_write_volume_tick (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+
+    vol->volume_tick = 0;
+    volumealsa_write_volume (vol);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean volumealsa_write_volume_timer (gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+
+    vol->volume_timer = 0;
+    volumealsa_write_volume (vol);
+    return G_SOURCE_REMOVE;
+}
+
 /* Handler for "toggled" signal on popup window mute checkbox. */
 static void volumealsa_popup_mute_toggled (GtkWidget *widget, VolumeALSAPlugin *vol)
 {
     /* Reflect the mute toggle to the sound system. */
-    asound_set_mute (vol, gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (widget)));
+    asound_fade_mute (vol, gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (widget)));
 
     /* Redraw the controls. */
     volumealsa_update_display (vol);
@@ -2387,16 +3844,20 @@ static gboolean volumealsa_popup_button_press (GtkWidget *widget, GdkEventButton
 static void show_options (VolumeALSAPlugin *vol, snd_mixer_t *mixer, gboolean input, char *devname)
 {
     snd_mixer_elem_t *elem;
-    GtkWidget *slid, *box, *btn, *scr, *wid;
-    GtkAdjustment *adj;
-    int swval;
-    char *lbl;
+    GtkWidget *box, *btn, *scr, *wid;
+    int nplay = 0, ncapt = 0;
 
     vol->options_play = NULL;
     vol->options_capt = NULL;
     vol->options_set = NULL;
-
-    // loop through elements, adding controls to relevant tabs
+    vol->options_ctrls = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    vol->options_store[0] = vol->options_store[1] = NULL;
+    vol->options_rows[0] = vol->options_rows[1] = NULL;
+    vol->options_mixer = mixer;
+    vol->options_filled = 0;
+
+    // loop through elements to find which tabs are needed - the controls on each tab are
+    // only created when it is first shown, so the window can be shown straight away
     for (elem = snd_mixer_first_elem (mixer); elem != NULL; elem = snd_mixer_elem_next (elem))
     {
 #if 0
@@ -2408,120 +3869,34 @@ static void show_options (VolumeALSAPlugin *vol, snd_mixer_t *mixer, gboolean in
             snd_mixer_selem_has_capture_volume (elem),
             snd_mixer_selem_has_capture_switch (elem));
 #endif
-        if (snd_mixer_selem_has_playback_volume (elem))
-        {
-            if (!vol->options_play) vol->options_play = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
-            box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-            gtk_box_pack_start (GTK_BOX (vol->options_play), box, FALSE, FALSE, 5);
-            gtk_box_pack_start (GTK_BOX (box), gtk_label_new (snd_mixer_selem_get_name (elem)), FALSE, FALSE, 5);
-            if (snd_mixer_selem_has_playback_switch (elem))
-            {
-                btn = gtk_check_button_new_with_label (_("Enable"));
-                gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
-                snd_mixer_selem_get_playback_switch (elem, SND_MIXER_SCHN_MONO, &swval);
-                gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (btn), swval);
-                gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
-                g_signal_connect (btn, "toggled", G_CALLBACK (playback_switch_toggled_event), elem);
-            }
-            adj = gtk_adjustment_new (50.0, 0.0, 100.0, 1.0, 0.0, 0.0);
-            slid = gtk_scale_new (GTK_ORIENTATION_VERTICAL, GTK_ADJUSTMENT (adj));
-            gtk_widget_set_name (slid, snd_mixer_selem_get_name (elem));
-            gtk_range_set_inverted (GTK_RANGE (slid), TRUE);
-            gtk_range_set_value (GTK_RANGE (slid), get_normalized_volume (elem, FALSE));
-            gtk_widget_set_size_request (slid, 80, 150);
-            gtk_scale_set_draw_value (GTK_SCALE (slid), FALSE);
-            gtk_box_pack_start (GTK_BOX (box), slid, FALSE, FALSE, 0);
-            g_signal_connect (slid, "value-changed", G_CALLBACK (playback_range_change_event), elem);
-        }
+        if (snd_mixer_selem_has_playback_volume (elem)) nplay++;
         else if (snd_mixer_selem_has_playback_switch (elem))
         {
             if (!vol->options_set) vol->options_set = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-            box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
-            lbl = g_strdup_printf (_("%s (Playback)"), snd_mixer_selem_get_name (elem));
-            gtk_box_pack_start (GTK_BOX (box), gtk_label_new (lbl), FALSE, FALSE, 5);
-            g_free (lbl);
-            btn = gtk_check_button_new ();
-            gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
-            gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
-            snd_mixer_selem_get_playback_switch (elem, SND_MIXER_SCHN_MONO, &swval);
-            gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (btn), swval);
-            gtk_box_pack_start (GTK_BOX (vol->options_set), box, FALSE, FALSE, 5);
-            g_signal_connect (btn, "toggled", G_CALLBACK (playback_switch_toggled_event), elem);
         }
 
-        if (snd_mixer_selem_has_capture_volume (elem))
-        {
-            if (!vol->options_capt) vol->options_capt = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
-            box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-            gtk_box_pack_start (GTK_BOX (vol->options_capt), box, FALSE, FALSE, 5);
-            gtk_box_pack_start (GTK_BOX (box), gtk_label_new (snd_mixer_selem_get_name (elem)), FALSE, FALSE, 5);
-            if (snd_mixer_selem_has_capture_switch (elem))
-            {
-                btn = gtk_check_button_new_with_label (_("Enable"));
-                gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
-                snd_mixer_selem_get_capture_switch (elem, SND_MIXER_SCHN_MONO, &swval);
-                gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (btn), swval);
-                gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
-                g_signal_connect (btn, "toggled", G_CALLBACK (capture_switch_toggled_event), elem);
-            }
-            adj = gtk_adjustment_new (50.0, 0.0, 100.0, 1.0, 0.0, 0.0);
-            slid = gtk_scale_new (GTK_ORIENTATION_VERTICAL, GTK_ADJUSTMENT (adj));
-            gtk_widget_set_name (slid, snd_mixer_selem_get_name (elem));
-            gtk_range_set_inverted (GTK_RANGE (slid), TRUE);
-            gtk_range_set_value (GTK_RANGE (slid), get_normalized_volume (elem, TRUE));
-            gtk_widget_set_size_request (slid, 80, 150);
-            gtk_scale_set_draw_value (GTK_SCALE (slid), FALSE);
-            gtk_box_pack_start (GTK_BOX (box), slid, FALSE, FALSE, 0);
-            g_signal_connect (slid, "value-changed", G_CALLBACK (capture_range_change_event), elem);
-        }
+        if (snd_mixer_selem_has_capture_volume (elem)) ncapt++;
         else if (snd_mixer_selem_has_capture_switch (elem))
         {
             if (!vol->options_set) vol->options_set = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-            box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
-            lbl = g_strdup_printf (_("%s (Capture)"), snd_mixer_selem_get_name (elem));
-            gtk_box_pack_start (GTK_BOX (box), gtk_label_new (lbl), FALSE, FALSE, 5);
-            g_free (lbl);
-            btn = gtk_check_button_new ();
-            gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
-            gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
-            snd_mixer_selem_get_capture_switch (elem, SND_MIXER_SCHN_MONO, &swval);
-            gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (btn), swval);
-            gtk_box_pack_start (GTK_BOX (vol->options_set), box, FALSE, FALSE, 5);
-            g_signal_connect (btn, "toggled", G_CALLBACK (capture_switch_toggled_event), elem);
         }
 
         if (snd_mixer_selem_is_enumerated (elem))
         {
             if (!vol->options_set) vol->options_set = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
-            box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
-            if (snd_mixer_selem_is_enum_playback (elem) && !snd_mixer_selem_is_enum_capture (elem))
-                lbl = g_strdup_printf (_("%s (Playback)"), snd_mixer_selem_get_name (elem));
-            else if (snd_mixer_selem_is_enum_capture (elem) && !snd_mixer_selem_is_enum_playback (elem))
-                lbl = g_strdup_printf (_("%s (Capture)"), snd_mixer_selem_get_name (elem));
-            else
-                lbl = g_strdup_printf ("%s", snd_mixer_selem_get_name (elem));
-            gtk_box_pack_start (GTK_BOX (box), gtk_label_new (lbl), FALSE, FALSE, 5);
-            g_free (lbl);
-            btn = gtk_combo_box_text_new ();
-            gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
-            gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
-            int items = snd_mixer_selem_get_enum_items (elem);
-            for (int i = 0; i < items; i++)
-            {
-                char buffer[128];
-                snd_mixer_selem_get_enum_item_name (elem, i, 128, buffer);
-                gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (btn), buffer);
-            }
-            unsigned int sel;
-            snd_mixer_selem_get_enum_item (elem, SND_MIXER_SCHN_MONO, &sel);
-            gtk_combo_box_set_active (GTK_COMBO_BOX (btn), sel);
-            gtk_box_pack_start (GTK_BOX (vol->options_set), box, FALSE, FALSE, 5);
-            g_signal_connect (btn, "changed", G_CALLBACK (enum_changed_event), elem);
         }
     }
 
+    // devices with many volume controls show them in a list, which only draws the visible rows,
+    // rather than a slider for each
+    if (nplay > OPTIONS_LIST_THRESHOLD) vol->options_play = options_list_new (vol, FALSE);
+    else if (nplay) vol->options_play = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
+    if (ncapt > OPTIONS_LIST_THRESHOLD) vol->options_capt = options_list_new (vol, TRUE);
+    else if (ncapt) vol->options_capt = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
+
     // create the window itself
     vol->options_dlg = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    volumealsa_queue_device_menu (vol);
     gtk_window_set_title (GTK_WINDOW (vol->options_dlg), input ? _("Input Device Options") : _("Output Device Options"));
     gtk_window_set_position (GTK_WINDOW (vol->options_dlg), GTK_WIN_POS_CENTER);
     gtk_window_set_default_size (GTK_WINDOW (vol->options_dlg), 400, 300);
@@ -2548,15 +3923,27 @@ static void show_options (VolumeALSAPlugin *vol, snd_mixer_t *mixer, gboolean in
         if (vol->options_play)
         {
             scr = gtk_scrolled_window_new (NULL, NULL);
-            gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scr), GTK_POLICY_AUTOMATIC, GTK_POLICY_NEVER);
+            if (vol->options_store[0])
+            {
+                gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scr), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+                gtk_scrolled_window_set_min_content_height (GTK_SCROLLED_WINDOW (scr), 200);
+            }
+            else gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scr), GTK_POLICY_AUTOMATIC, GTK_POLICY_NEVER);
             gtk_container_add (GTK_CONTAINER (scr), vol->options_play);
+            g_object_set_data (G_OBJECT (scr), "page", GINT_TO_POINTER (OPT_PAGE_PLAYBACK));
             gtk_notebook_append_page (GTK_NOTEBOOK (wid), scr, gtk_label_new (_("Playback")));
         }
         if (vol->options_capt)
         {
             scr = gtk_scrolled_window_new (NULL, NULL);
-            gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scr), GTK_POLICY_AUTOMATIC, GTK_POLICY_NEVER);
+            if (vol->options_store[1])
+            {
+                gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scr), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+                gtk_scrolled_window_set_min_content_height (GTK_SCROLLED_WINDOW (scr), 200);
+            }
+            else gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scr), GTK_POLICY_AUTOMATIC, GTK_POLICY_NEVER);
             gtk_container_add (GTK_CONTAINER (scr), vol->options_capt);
+            g_object_set_data (G_OBJECT (scr), "page", GINT_TO_POINTER (OPT_PAGE_CAPTURE));
             gtk_notebook_append_page (GTK_NOTEBOOK (wid), scr, gtk_label_new (_("Capture")));
         }
         if (vol->options_set)
@@ -2564,9 +3951,15 @@ static void show_options (VolumeALSAPlugin *vol, snd_mixer_t *mixer, gboolean in
             scr = gtk_scrolled_window_new (NULL, NULL);
             gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scr), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
             gtk_container_add (GTK_CONTAINER (scr), vol->options_set);
+            g_object_set_data (G_OBJECT (scr), "page", GINT_TO_POINTER (OPT_PAGE_SETTINGS));
             gtk_notebook_append_page (GTK_NOTEBOOK (wid), scr, gtk_label_new (_("Options")));
         }
         gtk_box_pack_start (GTK_BOX (box), wid, FALSE, FALSE, 5);
+        g_signal_connect (wid, "switch-page", G_CALLBACK (options_page_switched), vol);
+
+        // fill in the first tab once the window is up
+        vol->options_notebook = wid;
+        vol->options_idle = g_idle_add (options_fill_idle, vol);
     }
 
     wid = gtk_button_box_new (GTK_ORIENTATION_HORIZONTAL);
@@ -2580,6 +3973,303 @@ static void show_options (VolumeALSAPlugin *vol, snd_mixer_t *mixer, gboolean in
     gtk_widget_show_all (vol->options_dlg);
 }
 
+/* Create the controls on a tab of the options dialog, if not done already */
+static void options_fill_page (VolumeALSAPlugin *vol, OptionPage page)
+{
+    snd_mixer_elem_t *elem;
+    GtkWidget *slid, *box, *btn, *tab;
+    GtkAdjustment *adj;
+    int swval;
+    char *lbl;
+    gint64 start;
+
+    if (!vol->options_mixer || (vol->options_filled & (1u << page))) return;
+    vol->options_filled |= 1u << page;
+    start = stat_start ();
+
+    for (elem = snd_mixer_first_elem (vol->options_mixer); elem != NULL; elem = snd_mixer_elem_next (elem))
+    {
+        if (page == OPT_PAGE_PLAYBACK && vol->options_store[0])
+        {
+            if (snd_mixer_selem_has_playback_volume (elem)) options_list_add (vol, elem, FALSE);
+        }
+        else if (page == OPT_PAGE_CAPTURE && vol->options_store[1])
+        {
+            if (snd_mixer_selem_has_capture_volume (elem)) options_list_add (vol, elem, TRUE);
+        }
+        else if (page == OPT_PAGE_PLAYBACK)
+        {
+            if (snd_mixer_selem_has_playback_volume (elem))
+            {
+                box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
+                gtk_box_pack_start (GTK_BOX (vol->options_play), box, FALSE, FALSE, 5);
+                gtk_box_pack_start (GTK_BOX (box), gtk_label_new (snd_mixer_selem_get_name (elem)), FALSE, FALSE, 5);
+                if (snd_mixer_selem_has_playback_switch (elem))
+                {
+                    btn = gtk_check_button_new_with_label (_("Enable"));
+                    gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
+                    snd_mixer_selem_get_playback_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+                    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (btn), swval);
+                    gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
+                    g_signal_connect (btn, "toggled", G_CALLBACK (playback_switch_toggled_event), elem);
+                    options_add_control (vol, elem, OPT_PLAYBACK_SWITCH, btn);
+                }
+                adj = gtk_adjustment_new (50.0, 0.0, 100.0, 1.0, 0.0, 0.0);
+                slid = gtk_scale_new (GTK_ORIENTATION_VERTICAL, GTK_ADJUSTMENT (adj));
+                gtk_widget_set_name (slid, snd_mixer_selem_get_name (elem));
+                gtk_range_set_inverted (GTK_RANGE (slid), TRUE);
+                gtk_range_set_value (GTK_RANGE (slid), get_normalized_volume (elem, FALSE));
+                gtk_widget_set_size_request (slid, 80, 150);
+                gtk_scale_set_draw_value (GTK_SCALE (slid), FALSE);
+                gtk_box_pack_start (GTK_BOX (box), slid, FALSE, FALSE, 0);
+                g_signal_connect (slid, "value-changed", G_CALLBACK (playback_range_change_event), elem);
+                options_add_control (vol, elem, OPT_PLAYBACK_VOLUME, slid);
+            }
+        }
+        else if (page == OPT_PAGE_CAPTURE)
+        {
+            if (snd_mixer_selem_has_capture_volume (elem))
+            {
+                box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
+                gtk_box_pack_start (GTK_BOX (vol->options_capt), box, FALSE, FALSE, 5);
+                gtk_box_pack_start (GTK_BOX (box), gtk_label_new (snd_mixer_selem_get_name (elem)), FALSE, FALSE, 5);
+                if (snd_mixer_selem_has_capture_switch (elem))
+                {
+                    btn = gtk_check_button_new_with_label (_("Enable"));
+                    gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
+                    snd_mixer_selem_get_capture_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+                    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (btn), swval);
+                    gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
+                    g_signal_connect (btn, "toggled", G_CALLBACK (capture_switch_toggled_event), elem);
+                    options_add_control (vol, elem, OPT_CAPTURE_SWITCH, btn);
+                }
+                adj = gtk_adjustment_new (50.0, 0.0, 100.0, 1.0, 0.0, 0.0);
+                slid = gtk_scale_new (GTK_ORIENTATION_VERTICAL, GTK_ADJUSTMENT (adj));
+                gtk_widget_set_name (slid, snd_mixer_selem_get_name (elem));
+                gtk_range_set_inverted (GTK_RANGE (slid), TRUE);
+                gtk_range_set_value (GTK_RANGE (slid), get_normalized_volume (elem, TRUE));
+                gtk_widget_set_size_request (slid, 80, 150);
+                gtk_scale_set_draw_value (GTK_SCALE (slid), FALSE);
+                gtk_box_pack_start (GTK_BOX (box), slid, FALSE, FALSE, 0);
+                g_signal_connect (slid, "value-changed", G_CALLBACK (capture_range_change_event), elem);
+                options_add_control (vol, elem, OPT_CAPTURE_VOLUME, slid);
+            }
+        }
+        else
+        {
+            if (!snd_mixer_selem_has_playback_volume (elem) && snd_mixer_selem_has_playback_switch (elem))
+            {
+                box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
+                lbl = g_strdup_printf (_("%s (Playback)"), snd_mixer_selem_get_name (elem));
+                gtk_box_pack_start (GTK_BOX (box), gtk_label_new (lbl), FALSE, FALSE, 5);
+                g_free (lbl);
+                btn = gtk_check_button_new ();
+                gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
+                gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
+                snd_mixer_selem_get_playback_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+                gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (btn), swval);
+                gtk_box_pack_start (GTK_BOX (vol->options_set), box, FALSE, FALSE, 5);
+                g_signal_connect (btn, "toggled", G_CALLBACK (playback_switch_toggled_event), elem);
+                options_add_control (vol, elem, OPT_PLAYBACK_SWITCH, btn);
+            }
+
+            if (!snd_mixer_selem_has_capture_volume (elem) && snd_mixer_selem_has_capture_switch (elem))
+            {
+                box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
+                lbl = g_strdup_printf (_("%s (Capture)"), snd_mixer_selem_get_name (elem));
+                gtk_box_pack_start (GTK_BOX (box), gtk_label_new (lbl), FALSE, FALSE, 5);
+                g_free (lbl);
+                btn = gtk_check_button_new ();
+                gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
+                gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
+                snd_mixer_selem_get_capture_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+                gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (btn), swval);
+                gtk_box_pack_start (GTK_BOX (vol->options_set), box, FALSE, FALSE, 5);
+                g_signal_connect (btn, "toggled", G_CALLBACK (capture_switch_toggled_event), elem);
+                options_add_control (vol, elem, OPT_CAPTURE_SWITCH, btn);
+            }
+
+            if (snd_mixer_selem_is_enumerated (elem))
+            {
+                box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
+                if (snd_mixer_selem_is_enum_playback (elem) && !snd_mixer_selem_is_enum_capture (elem))
+                    lbl = g_strdup_printf (_("%s (Playback)"), snd_mixer_selem_get_name (elem));
+                else if (snd_mixer_selem_is_enum_capture (elem) && !snd_mixer_selem_is_enum_playback (elem))
+                    lbl = g_strdup_printf (_("%s (Capture)"), snd_mixer_selem_get_name (elem));
+                else
+                    lbl = g_strdup_printf ("%s", snd_mixer_selem_get_name (elem));
+                gtk_box_pack_start (GTK_BOX (box), gtk_label_new (lbl), FALSE, FALSE, 5);
+                g_free (lbl);
+                btn = gtk_combo_box_text_new ();
+                gtk_box_pack_end (GTK_BOX (box), btn, FALSE, FALSE, 5);
+                gtk_widget_set_name (btn, snd_mixer_selem_get_name (elem));
+                int items = snd_mixer_selem_get_enum_items (elem);
+                for (int i = 0; i < items; i++)
+                {
+                    char buffer[128];
+                    snd_mixer_selem_get_enum_item_name (elem, i, 128, buffer);
+                    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (btn), buffer);
+                }
+                unsigned int sel;
+                snd_mixer_selem_get_enum_item (elem, SND_MIXER_SCHN_MONO, &sel);
+                gtk_combo_box_set_active (GTK_COMBO_BOX (btn), sel);
+                gtk_box_pack_start (GTK_BOX (vol->options_set), box, FALSE, FALSE, 5);
+                g_signal_connect (btn, "changed", G_CALLBACK (enum_changed_event), elem);
+                options_add_control (vol, elem, OPT_ENUM, btn);
+            }
+        }
+    }
+
+    if (page == OPT_PAGE_PLAYBACK) tab = vol->options_play;
+    else if (page == OPT_PAGE_CAPTURE) tab = vol->options_capt;
+    else tab = vol->options_set;
+    gtk_widget_show_all (tab);
+    stat_end (vol, G_STRFUNC, start);
+}
+
+static gboolean options_fill_idle (gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    GtkNotebook *nb = GTK_NOTEBOOK (vol->options_notebook);
+    GtkWidget *page = gtk_notebook_get_nth_page (nb, gtk_notebook_get_current_page (nb));
+
+    vol->options_idle = 0;
+    if (page) options_fill_page (vol, GPOINTER_TO_INT (g_object_get_data (G_OBJECT (page), "page")));
+    return FALSE;
+}
+
+static void options_page_switched (GtkNotebook *notebook, GtkWidget *page, guint page_num, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+
+    options_fill_page (vol, GPOINTER_TO_INT (g_object_get_data (G_OBJECT (page), "page")));
+}
+
+/* Create a list of volume controls - each row has the element name, its level, a spin button
+ * to set the level and a check box for the element's switch if it has one */
+static GtkWidget *options_list_new (VolumeALSAPlugin *vol, gboolean capture)
+{
+    GtkWidget *tree;
+    GtkCellRenderer *cell;
+    GtkTreeViewColumn *col;
+
+    vol->options_store[capture] = gtk_list_store_new (NUM_OPT_COLS, G_TYPE_POINTER, G_TYPE_STRING, G_TYPE_INT, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN);
+    vol->options_rows[capture] = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+
+    tree = gtk_tree_view_new_with_model (GTK_TREE_MODEL (vol->options_store[capture]));
+    g_object_unref (vol->options_store[capture]);
+    gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (tree), FALSE);
+
+    cell = gtk_cell_renderer_text_new ();
+    col = gtk_tree_view_column_new_with_attributes (NULL, cell, "text", OPT_COL_NAME, NULL);
+    gtk_tree_view_column_set_sizing (col, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width (col, 150);
+    gtk_tree_view_column_set_expand (col, TRUE);
+    gtk_tree_view_append_column (GTK_TREE_VIEW (tree), col);
+
+    cell = gtk_cell_renderer_progress_new ();
+    g_object_set (cell, "text", "", NULL);
+    col = gtk_tree_view_column_new_with_attributes (NULL, cell, "value", OPT_COL_VOLUME, NULL);
+    gtk_tree_view_column_set_sizing (col, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width (col, 100);
+    gtk_tree_view_append_column (GTK_TREE_VIEW (tree), col);
+
+    cell = gtk_cell_renderer_spin_new ();
+    g_object_set (cell, "editable", TRUE, "digits", 0, "adjustment", gtk_adjustment_new (0.0, 0.0, 100.0, 1.0, 10.0, 0.0), NULL);
+    g_object_set_data (G_OBJECT (cell), "capture", GINT_TO_POINTER (capture));
+    g_signal_connect (cell, "edited", G_CALLBACK (options_list_volume_edited), vol);
+    col = gtk_tree_view_column_new_with_attributes (NULL, cell, "text", OPT_COL_VOLUME, NULL);
+    gtk_tree_view_column_set_sizing (col, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width (col, 60);
+    gtk_tree_view_append_column (GTK_TREE_VIEW (tree), col);
+
+    cell = gtk_cell_renderer_toggle_new ();
+    g_object_set_data (G_OBJECT (cell), "capture", GINT_TO_POINTER (capture));
+    g_signal_connect (cell, "toggled", G_CALLBACK (options_list_switch_toggled), vol);
+    col = gtk_tree_view_column_new_with_attributes (NULL, cell, "active", OPT_COL_SWITCH, "visible", OPT_COL_HAS_SWITCH, NULL);
+    gtk_tree_view_column_set_sizing (col, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width (col, 30);
+    gtk_tree_view_append_column (GTK_TREE_VIEW (tree), col);
+
+    // all rows are the same height, so the view need not measure each one
+    gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (tree), TRUE);
+    return tree;
+}
+
+static void options_list_add (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem, gboolean capture)
+{
+    GtkTreeIter *iter = g_new (GtkTreeIter, 1);
+    gboolean has_switch;
+    int swval = 0;
+
+    has_switch = capture ? snd_mixer_selem_has_capture_switch (elem) : snd_mixer_selem_has_playback_switch (elem);
+    if (has_switch)
+    {
+        if (capture) snd_mixer_selem_get_capture_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+        else snd_mixer_selem_get_playback_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+    }
+
+    gtk_list_store_insert_with_values (vol->options_store[capture], iter, -1,
+        OPT_COL_ELEM, elem,
+        OPT_COL_NAME, snd_mixer_selem_get_name (elem),
+        OPT_COL_VOLUME, get_normalized_volume (elem, capture),
+        OPT_COL_SWITCH, swval ? TRUE : FALSE,
+        OPT_COL_HAS_SWITCH, has_switch,
+        -1);
+    g_hash_table_insert (vol->options_rows[capture], elem, iter);
+}
+
+/* Update the row for an element in a volume list */
+static void options_list_update (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem, gboolean capture)
+{
+    GtkTreeIter *iter;
+    int swval = 0;
+
+    if (!vol->options_rows[capture]) return;
+    iter = (GtkTreeIter *) g_hash_table_lookup (vol->options_rows[capture], elem);
+    if (!iter) return;
+
+    if (capture) snd_mixer_selem_get_capture_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+    else snd_mixer_selem_get_playback_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+    gtk_list_store_set (vol->options_store[capture], iter,
+        OPT_COL_VOLUME, get_normalized_volume (elem, capture),
+        OPT_COL_SWITCH, swval ? TRUE : FALSE,
+        -1);
+}
+
+static void options_list_volume_edited (GtkCellRendererText *cell, gchar *path, gchar *text, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    gboolean capture = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (cell), "capture"));
+    snd_mixer_elem_t *elem;
+    GtkTreeIter iter;
+    int volume;
+
+    if (!gtk_tree_model_get_iter_from_string (GTK_TREE_MODEL (vol->options_store[capture]), &iter, path)) return;
+    gtk_tree_model_get (GTK_TREE_MODEL (vol->options_store[capture]), &iter, OPT_COL_ELEM, &elem, -1);
+
+    volume = CLAMP (atoi (text), 0, 100);
+    set_normalized_volume (elem, volume, capture);
+    gtk_list_store_set (vol->options_store[capture], &iter, OPT_COL_VOLUME, get_normalized_volume (elem, capture), -1);
+}
+
+static void options_list_switch_toggled (GtkCellRendererToggle *cell, gchar *path, gpointer user_data)
+{
+    VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
+    gboolean capture = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (cell), "capture"));
+    snd_mixer_elem_t *elem;
+    GtkTreeIter iter;
+    gboolean active;
+
+    if (!gtk_tree_model_get_iter_from_string (GTK_TREE_MODEL (vol->options_store[capture]), &iter, path)) return;
+    gtk_tree_model_get (GTK_TREE_MODEL (vol->options_store[capture]), &iter, OPT_COL_ELEM, &elem, OPT_COL_SWITCH, &active, -1);
+
+    active = !active;
+    if (capture) snd_mixer_selem_set_capture_switch_all (elem, active);
+    else snd_mixer_selem_set_playback_switch_all (elem, active);
+    gtk_list_store_set (vol->options_store[capture], &iter, OPT_COL_SWITCH, active, -1);
+}
+
 static void show_output_options (VolumeALSAPlugin *vol)
 {
     if (vol->mixers[OUTPUT_MIXER].mixer)
@@ -2588,7 +4278,7 @@ static void show_output_options (VolumeALSAPlugin *vol)
 
 static void show_input_options (VolumeALSAPlugin *vol)
 {
-    if (asound_get_default_input () == asound_get_default_card ())
+    if (asound_get_default_input (vol) == asound_get_default_card (vol))
     {
         DEBUG ("Input and output device the same - use output mixer for dialog");
         if (vol->mixers[OUTPUT_MIXER].mixer)
@@ -2601,83 +4291,96 @@ static void show_input_options (VolumeALSAPlugin *vol)
     }
 }
 
-static void update_options (VolumeALSAPlugin *vol)
+/* Update the controls for a single element */
+static void update_options (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem)
 {
-    snd_mixer_elem_t *elem;
     GtkWidget *wid;
-    int swval, i;
+    int swval;
     unsigned int item;
 
-    i = vol->mixers[INPUT_MIXER].mixer ? 1 : 0;
-    for (elem = snd_mixer_first_elem (vol->mixers[i].mixer); elem != NULL; elem = snd_mixer_elem_next (elem))
+    /* elements shown in a volume list have no controls of their own for volume and switch */
+    if (snd_mixer_selem_has_playback_volume (elem)) options_list_update (vol, elem, FALSE);
+    if (snd_mixer_selem_has_capture_volume (elem)) options_list_update (vol, elem, TRUE);
+
+    if (snd_mixer_selem_has_playback_volume (elem))
     {
-        if (snd_mixer_selem_has_playback_volume (elem))
+        wid = options_find_control (vol, elem, OPT_PLAYBACK_VOLUME);
+        if (wid)
         {
-            wid = find_box_child (vol->options_play, GTK_TYPE_SCALE, snd_mixer_selem_get_name (elem));
-            if (wid)
-            {
-                g_signal_handlers_block_by_func (wid, playback_range_change_event, elem);
-                gtk_range_set_value (GTK_RANGE (wid), get_normalized_volume (elem, FALSE));
-                g_signal_handlers_unblock_by_func (wid, playback_range_change_event, elem);
-            }
+            g_signal_handlers_block_by_func (wid, playback_range_change_event, elem);
+            gtk_range_set_value (GTK_RANGE (wid), get_normalized_volume (elem, FALSE));
+            g_signal_handlers_unblock_by_func (wid, playback_range_change_event, elem);
         }
-        if (snd_mixer_selem_has_playback_switch (elem))
+    }
+    if (snd_mixer_selem_has_playback_switch (elem))
+    {
+        wid = options_find_control (vol, elem, OPT_PLAYBACK_SWITCH);
+        if (wid)
         {
-            wid = find_box_child (vol->options_play, GTK_TYPE_CHECK_BUTTON, snd_mixer_selem_get_name (elem));
-            if (!wid) wid = find_box_child (vol->options_set, GTK_TYPE_CHECK_BUTTON, snd_mixer_selem_get_name (elem));
-            if (wid)
-            {
-                snd_mixer_selem_get_playback_switch (elem, SND_MIXER_SCHN_MONO, &swval);
-                g_signal_handlers_block_by_func (wid, playback_switch_toggled_event, elem);
-                gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (wid), swval);
-                g_signal_handlers_unblock_by_func (wid, playback_switch_toggled_event, elem);
-            }
+            snd_mixer_selem_get_playback_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+            g_signal_handlers_block_by_func (wid, playback_switch_toggled_event, elem);
+            gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (wid), swval);
+            g_signal_handlers_unblock_by_func (wid, playback_switch_toggled_event, elem);
         }
-        if (snd_mixer_selem_has_capture_volume (elem))
+    }
+    if (snd_mixer_selem_has_capture_volume (elem))
+    {
+        wid = options_find_control (vol, elem, OPT_CAPTURE_VOLUME);
+        if (wid)
         {
-            wid = find_box_child (vol->options_capt, GTK_TYPE_SCALE, snd_mixer_selem_get_name (elem));
-            {
-                g_signal_handlers_block_by_func (wid, capture_range_change_event, elem);
-                gtk_range_set_value (GTK_RANGE (wid), get_normalized_volume (elem, TRUE));
-                g_signal_handlers_unblock_by_func (wid, capture_range_change_event, elem);
-            }
+            g_signal_handlers_block_by_func (wid, capture_range_change_event, elem);
+            gtk_range_set_value (GTK_RANGE (wid), get_normalized_volume (elem, TRUE));
+            g_signal_handlers_unblock_by_func (wid, capture_range_change_event, elem);
         }
-        if (snd_mixer_selem_has_capture_switch (elem))
+    }
+    if (snd_mixer_selem_has_capture_switch (elem))
+    {
+        wid = options_find_control (vol, elem, OPT_CAPTURE_SWITCH);
+        if (wid)
         {
-            wid = find_box_child (vol->options_capt, GTK_TYPE_CHECK_BUTTON, snd_mixer_selem_get_name (elem));
-            if (!wid) wid = find_box_child (vol->options_set, GTK_TYPE_CHECK_BUTTON, snd_mixer_selem_get_name (elem));
-            if (wid)
-            {
-                snd_mixer_selem_get_capture_switch (elem, SND_MIXER_SCHN_MONO, &swval);
-                g_signal_handlers_block_by_func (wid, capture_switch_toggled_event, elem);
-                gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (wid), swval);
-                g_signal_handlers_unblock_by_func (wid, capture_switch_toggled_event, elem);
-            }
+            snd_mixer_selem_get_capture_switch (elem, SND_MIXER_SCHN_MONO, &swval);
+            g_signal_handlers_block_by_func (wid, capture_switch_toggled_event, elem);
+            gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (wid), swval);
+            g_signal_handlers_unblock_by_func (wid, capture_switch_toggled_event, elem);
         }
-        if (snd_mixer_selem_is_enumerated (elem))
+    }
+    if (snd_mixer_selem_is_enumerated (elem))
+    {
+        wid = options_find_control (vol, elem, OPT_ENUM);
+        if (wid)
         {
-            wid = find_box_child (vol->options_set, GTK_TYPE_COMBO_BOX_TEXT, snd_mixer_selem_get_name (elem));
-            if (wid)
-            {
-                snd_mixer_selem_get_enum_item (elem, SND_MIXER_SCHN_MONO, &item);
-                g_signal_handlers_block_by_func (wid, enum_changed_event, elem);
-                gtk_combo_box_set_active (GTK_COMBO_BOX (wid), swval);
-                g_signal_handlers_unblock_by_func (wid, enum_changed_event, elem);
-            }
+            snd_mixer_selem_get_enum_item (elem, SND_MIXER_SCHN_MONO, &item);
+            g_signal_handlers_block_by_func (wid, enum_changed_event, elem);
+            gtk_combo_box_set_active (GTK_COMBO_BOX (wid), item);
+            g_signal_handlers_unblock_by_func (wid, enum_changed_event, elem);
         }
     }
 }
 
+
 static void close_options (VolumeALSAPlugin *vol)
 {
+    vol->options_mixer = NULL;
+
     if (vol->mixers[INPUT_MIXER].mixer)
     {
         DEBUG ("Deinitializing input mixer");
         asound_mixer_deinitialize (vol, INPUT_MIXER);
     }
 
+    if (vol->options_idle) g_source_remove (vol->options_idle);
+    vol->options_idle = 0;
+
     gtk_widget_destroy (vol->options_dlg);
     vol->options_dlg = NULL;
+    vol->options_notebook = NULL;
+    volumealsa_queue_device_menu (vol);
+    g_hash_table_destroy (vol->options_ctrls);
+    vol->options_ctrls = NULL;
+    if (vol->options_rows[0]) g_hash_table_destroy (vol->options_rows[0]);
+    if (vol->options_rows[1]) g_hash_table_destroy (vol->options_rows[1]);
+    vol->options_rows[0] = vol->options_rows[1] = NULL;
+    vol->options_store[0] = vol->options_store[1] = NULL;
 }
 
 static void options_ok_handler (GtkButton *button, gpointer *user_data)
@@ -2700,7 +4403,7 @@ static void playback_range_change_event (GtkRange *range, gpointer user_data)
     snd_mixer_elem_t *elem = (snd_mixer_elem_t *) user_data;
 
     int volume = (int) gtk_range_get_value (range);
-    set_normalized_volume (elem, volume, volume - get_normalized_volume (elem, FALSE), FALSE);
+    set_normalized_volume (elem, volume, FALSE);
 
     g_signal_handlers_block_by_func (range, playback_range_change_event, elem);
     gtk_range_set_value (range, get_normalized_volume (elem, FALSE));
@@ -2712,7 +4415,7 @@ static void capture_range_change_event (GtkRange *range, gpointer user_data)
     snd_mixer_elem_t *elem = (snd_mixer_elem_t *) user_data;
 
     int volume = (int) gtk_range_get_value (range);
-    set_normalized_volume (elem, volume, volume - get_normalized_volume (elem, TRUE), TRUE);
+    set_normalized_volume (elem, volume, TRUE);
 
     g_signal_handlers_block_by_func (range, capture_range_change_event, elem);
     gtk_range_set_value (range, get_normalized_volume (elem, TRUE));
@@ -2740,40 +4443,27 @@ static void enum_changed_event (GtkComboBox *combo, gpointer *user_data)
     snd_mixer_selem_set_enum_item (elem, SND_MIXER_SCHN_MONO, gtk_combo_box_get_active (combo));
 }
 
-static GtkWidget *find_box_child (GtkWidget *container, gint type, const char *name)
+/* The controls for each element are held in a table keyed by element, so they can be found
+ * when the element changes without searching the dialog */
+static void options_add_control (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem, OptionControl type, GtkWidget *wid)
 {
-    GList *l, *list = gtk_container_get_children (GTK_CONTAINER (container));
-    for (l = list; l; l = l->next)
+    GtkWidget **ctrls = g_hash_table_lookup (vol->options_ctrls, elem);
+
+    if (!ctrls)
     {
-        GList *m, *mist = gtk_container_get_children (GTK_CONTAINER (l->data));
-        for (m = mist; m; m = m->next)
-        {
-            if (G_OBJECT_TYPE (m->data) == type && !g_strcmp0 (name, gtk_widget_get_name (m->data)))
-            {
-                g_list_free (mist);
-                g_list_free (list);
-                return m->data;
-            }
-            if (G_OBJECT_TYPE (m->data) == GTK_TYPE_BUTTON_BOX)
-            {
-                GList *n, *nist = gtk_container_get_children (GTK_CONTAINER (m->data));
-                for (n = nist; n; n = n->next)
-                {
-                    if (G_OBJECT_TYPE (n->data) == type && !g_strcmp0 (name, gtk_widget_get_name (n->data)))
-                    {
-                        g_list_free (nist);
-                        g_list_free (mist);
-                        g_list_free (list);
-                        return n->data;
-                    }
-                }
-                g_list_free (nist);
-            }
-        }
-        g_list_free (mist);
+        ctrls = g_new0 (GtkWidget *, NUM_OPT_CONTROLS);
+        g_hash_table_insert (vol->options_ctrls, elem, ctrls);
     }
-    g_list_free (list);
-    return NULL;
+    ctrls[type] = wid;
+}
+
+static GtkWidget *options_find_control (VolumeALSAPlugin *vol, snd_mixer_elem_t *elem, OptionControl type)
+{
+    GtkWidget **ctrls;
+
+    if (!vol->options_ctrls) return NULL;
+    ctrls = g_hash_table_lookup (vol->options_ctrls, elem);
+    return ctrls ? ctrls[type] : NULL;
 }
 
 
@@ -2813,7 +4503,12 @@ static GtkWidget *volumealsa_configure (LXPanel *panel, GtkWidget *plugin)
     }
     g_free (path);
 
-    if (command_line) fm_launch_command_simple (NULL, NULL, flags, command_line, NULL);
+    if (command_line)
+    {
+        gint64 start = stat_start ();
+        fm_launch_command_simple (NULL, NULL, flags, command_line, NULL);
+        stat_end (vol, "fm_launch_command_simple", start);
+    }
     else
     {
         fm_show_error (NULL, NULL,
@@ -2832,7 +4527,7 @@ static void volumealsa_panel_configuration_changed (LXPanel *panel, GtkWidget *p
 
     volumealsa_build_popup_window (vol->plugin);
     volumealsa_update_display (vol);
-    if (vol->show_popup) gtk_widget_show_all (vol->popup_window);
+    if (vol->show_popup) gtk_widget_show (vol->popup_window);
 }
 
 /* Callback when control message arrives */
@@ -2853,6 +4548,7 @@ static gboolean volumealsa_control_msg (GtkWidget *plugin, const char *cmd)
     if (!strncmp (cmd, "stop", 4))
     {
         asound_deinitialize (vol);
+        asound_pool_flush (vol);
         volumealsa_update_display (vol);
         g_warning ("volumealsa: Stopped ALSA interface...");
         vol->stopped = TRUE;
@@ -2861,14 +4557,14 @@ static gboolean volumealsa_control_msg (GtkWidget *plugin, const char *cmd)
 
     if (!strncmp (cmd, "mute", 4))
     {
-        asound_set_mute (vol, asound_is_muted (vol) ? 0 : 1);
+        asound_fade_mute (vol, (asound_is_muted (vol) || vol->fade_mute) ? 0 : 1);
         volumealsa_update_display (vol);
         return TRUE;
     }
 
     if (!strncmp (cmd, "volu", 4))
     {
-        if (asound_is_muted (vol)) asound_set_mute (vol, 0);
+        if (asound_is_muted (vol) || vol->fade_mute) asound_fade_mute (vol, 0);
         else
         {
             int volume = asound_get_volume (vol);
@@ -2878,6 +4574,7 @@ static gboolean volumealsa_control_msg (GtkWidget *plugin, const char *cmd)
                 volume /= 5;
                 volume *= 5;
             }
+            asound_fade_cancel (vol);
             asound_set_volume (vol, volume);
         }
         volumealsa_update_display (vol);
@@ -2886,7 +4583,7 @@ static gboolean volumealsa_control_msg (GtkWidget *plugin, const char *cmd)
 
     if (!strncmp (cmd, "vold", 4))
     {
-        if (asound_is_muted (vol)) asound_set_mute (vol, 0);
+        if (asound_is_muted (vol) || vol->fade_mute) asound_fade_mute (vol, 0);
         else
         {
             int volume = asound_get_volume (vol);
@@ -2896,23 +4593,41 @@ static gboolean volumealsa_control_msg (GtkWidget *plugin, const char *cmd)
                 volume /= 5;
                 volume *= 5;
             }
+            asound_fade_cancel (vol);
             asound_set_volume (vol, volume);
         }
         volumealsa_update_display (vol);
         return TRUE;
     }
 
+    if (!strncmp (cmd, "fade", 4))
+    {
+        int volume, ms;
+        if (sscanf (cmd, "fade:%d:%d", &volume, &ms) == 2)
+        {
+            asound_fade_volume (vol, CLAMP (volume, 0, 100), ms);
+            volumealsa_update_display (vol);
+        }
+        return TRUE;
+    }
+
+    if (!strncmp (cmd, "stat", 4))
+    {
+        stat_dump (vol);
+        return TRUE;
+    }
+
     if (!strncmp (cmd, "hw:", 3))
     {
         int dev;
         if (sscanf (cmd, "hw:%d", &dev) == 1)
         {
             /* if there is a Bluetooth device in use, get its name so we can disconnect it */
-            char *device = asound_get_bt_device ();
-            char *idevice = asound_get_bt_input ();
+            char *device = asound_get_bt_device (vol);
+            char *idevice = asound_get_bt_input (vol);
 
-            asound_set_default_card (dev);
-            asound_set_default_input (dev);
+            asound_set_default_card (vol, dev);
+            asound_set_default_input (vol, dev);
             asound_initialize (vol);
             volumealsa_update_display (vol);
 
@@ -2957,31 +4672,68 @@ static GtkWidget *volumealsa_constructor (LXPanel *panel, config_setting_t *sett
     g_signal_connect (vol->plugin, "scroll-event", G_CALLBACK (volumealsa_popup_scale_scrolled), vol);
     gtk_widget_add_events (vol->plugin, GDK_SCROLL_MASK);
     gtk_widget_set_tooltip_text (vol->plugin, _("Volume control"));
+    volumealsa_reset_display (vol);
 
     /* Set up variables */
     vol->bt_conname = NULL;
     vol->bt_reconname = NULL;
-    vol->master_element = NULL;
+    asound_set_master_elem (vol, NULL);
     vol->options_dlg = NULL;
     vol->odev_name = NULL;
     vol->idev_name = NULL;
     vol->mixers[OUTPUT_MIXER].mixer = NULL;
     vol->mixers[INPUT_MIXER].mixer = NULL;
+    vol->mixer_pool = NULL;
     vol->stopped = FALSE;
+    vol->volume_pending = -1;
+    vol->volume_echo = -1;
+
+    /* Read the interval between volume writes while dragging the slider */
+    if (!config_setting_lookup_int (settings, "VolumeWriteInterval", &vol->volume_interval) || vol->volume_interval < 0)
+        vol->volume_interval = 0;
+
+    /* Read the duration of the fade on mute and unmute */
+    if (!config_setting_lookup_int (settings, "MuteFadeTime", &vol->mute_fade_time) || vol->mute_fade_time < 0)
+        vol->mute_fade_time = MUTE_FADE_TIME;
+
+    /* Watch .asoundrc so that cached device settings are reread when it changes */
+    char *user_config_file = g_build_filename (g_get_home_dir (), "/.asoundrc", NULL);
+    GFile *file = g_file_new_for_path (user_config_file);
+    vol->asoundrc_mon = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+    if (vol->asoundrc_mon) g_signal_connect (vol->asoundrc_mon, "changed", G_CALLBACK (asound_config_changed), vol);
+    g_object_unref (file);
+    g_free (user_config_file);
+
+    /* Find the installed sound cards, and watch for cards being added or removed */
+    vol->analog = asound_has_analog ();
+    asound_build_card_table (vol);
+    file = g_file_new_for_path ("/dev/snd");
+    vol->cards_mon = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL);
+    if (vol->cards_mon) g_signal_connect (vol->cards_mon, "changed", G_CALLBACK (asound_cards_changed), vol);
+    g_object_unref (file);
 
     /* Initialize ALSA if default device isn't Bluetooth */
-    if (asound_get_default_card () != BLUEALSA_DEV) asound_initialize (vol);
+    if (asound_get_default_card (vol) != BLUEALSA_DEV) asound_initialize (vol);
 
     /* Set up callbacks to see if BlueZ is on DBus */
     vol->baproxy = NULL;
     g_bus_watch_name (G_BUS_TYPE_SYSTEM, "org.bluez", 0, bt_cb_name_owned, bt_cb_name_unowned, vol, NULL);
     g_bus_watch_name (G_BUS_TYPE_SYSTEM, "org.bluealsa", 0, bt_cb_ba_name_owned, bt_cb_ba_name_unowned, vol, NULL);
 
-    /* Set up for multiple HDMIs */
-    vol->hdmis = hdmi_monitors (vol);
+    /* Set up for multiple HDMIs, and watch for monitors being connected or disconnected */
+    hdmi_monitors (vol);
+    if (gdk_display_get_default ())
+    {
+        g_signal_connect (gdk_display_get_default (), "monitor-added", G_CALLBACK (hdmi_monitors_changed), vol);
+        g_signal_connect (gdk_display_get_default (), "monitor-removed", G_CALLBACK (hdmi_monitors_changed), vol);
+    }
+
+    /* Build the volume popup, which is kept until the panel configuration changes */
+    volumealsa_build_popup_window (vol->plugin);
 
     /* Show the widget and return. */
     gtk_widget_show_all (vol->plugin);
+    volumealsa_update_display (vol);
     return vol->plugin;
 }
 
@@ -2992,13 +4744,45 @@ static void volumealsa_destructor (gpointer user_data)
     VolumeALSAPlugin *vol = (VolumeALSAPlugin *) user_data;
 
     asound_deinitialize (vol);
+    asound_pool_flush (vol);
 
     /* If the dialog box is open, dismiss it. */
     if (vol->popup_window != NULL) gtk_widget_destroy (vol->popup_window);
     if (vol->menu_popup != NULL) gtk_widget_destroy (vol->menu_popup);
+    if (vol->menu_items[OUTPUT_MIXER]) g_hash_table_destroy (vol->menu_items[OUTPUT_MIXER]);
+    if (vol->menu_items[INPUT_MIXER]) g_hash_table_destroy (vol->menu_items[INPUT_MIXER]);
 
     if (vol->restart_idle) g_source_remove (vol->restart_idle);
 
+    if (vol->asoundrc_mon)
+    {
+        g_file_monitor_cancel (vol->asoundrc_mon);
+        g_object_unref (vol->asoundrc_mon);
+    }
+    asound_free_config (&vol->asoundrc);
+
+    if (vol->cards_idle) g_source_remove (vol->cards_idle);
+    if (vol->cards_mon)
+    {
+        g_file_monitor_cancel (vol->cards_mon);
+        g_object_unref (vol->cards_mon);
+    }
+    asound_route_close (vol);
+    asound_free_card_table (vol);
+
+    if (gdk_display_get_default ()) g_signal_handlers_disconnect_by_data (gdk_display_get_default (), vol);
+    g_strfreev (vol->mon_names);
+    if (vol->objmanager) g_signal_handlers_disconnect_by_data (vol->objmanager, vol);
+
+    if (vol->stats) g_hash_table_destroy (vol->stats);
+
+    /* any tick callback goes with the plugin widget */
+    if (vol->display_idle) g_source_remove (vol->display_idle);
+    if (vol->volume_timer) g_source_remove (vol->volume_timer);
+    if (vol->fade_timer) g_source_remove (vol->fade_timer);
+    if (vol->menu_idle) g_source_remove (vol->menu_idle);
+    if (vol->options_idle) g_source_remove (vol->options_idle);
+
     /* Deallocate all memory. */
     g_free (vol);
 }